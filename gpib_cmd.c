@@ -0,0 +1,88 @@
+/*****************************************************************************
+Firmware for Galvant Industries GPIBUSB Adapter Revision 3 & 4
+Copyright (C) 2019  Steve Matos
+
+GPIBUSB adapter hardware designed by Steven Casagrande (scasagrande@galvant.ca)
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+This code requires the CCS compiler from <https://www.ccsinfo.com/> to compile.
+A pre-compiled hex file is included at
+<https://github.com/steve1515/gpibusb-firmware>
+*****************************************************************************/
+
+
+// Controller Command Lookup
+// =========================
+// Included by gpib_usb.c (See the command table in gpib_cmd.h). Only
+// standard C is used here, so the lookup can also be compiled and
+// benchmarked on a host (See test/).
+
+
+void command_table_init()
+{
+    // This function builds the index of the first command table entry
+    // for each first character of a command name.
+    // Note: Command table entries must be grouped by first character.
+    //       A group may hold any number of entries (currently up to 6,
+    //       e.g. 'a' and 's'), the lookup compares only that group.
+    
+    
+    uint8_t i = 0;
+    
+    for (uint8_t c = 0; c < 26; c++)
+    {
+        _commandIndex[c] = i;
+        
+        while (i < COMMAND_COUNT && _commandTable[i].name[0] == ('a' + c))
+            i++;
+    }
+    
+    _commandIndex[26] = i;
+}
+
+
+uint8_t command_lookup(char *name)
+{
+    // This function finds a command in the command table.
+    // Only the table entries with the same first character are compared,
+    // so the lookup time does not depend on the position of the command
+    // in the table.
+    //
+    // Parameters:
+    //   [in] name: Null terminated command name (without '++')
+    //
+    // Return Value: Command table index; CMD_NONE if not found
+    
+    
+    // Command names start with a lower case letter
+    if (name[0] < 'a' || name[0] > 'z')
+        return CMD_NONE;
+    
+    uint8_t c = name[0] - 'a';
+    
+    for (uint8_t i = _commandIndex[c]; i < _commandIndex[c + 1]; i++)
+    {
+        uint8_t j = 1;
+        
+        // Compare remaining characters (Names must match exactly)
+        while (j < COMMAND_NAME_LEN && name[j] != '\0' && _commandTable[i].name[j] == name[j])
+            j++;
+        
+        if (j < COMMAND_NAME_LEN && _commandTable[i].name[j] == name[j])
+            return i;
+    }
+    
+    return CMD_NONE;
+}
@@ -0,0 +1,158 @@
+/*****************************************************************************
+Firmware for Galvant Industries GPIBUSB Adapter Revision 3 & 4
+Copyright (C) 2019  Steve Matos
+
+GPIBUSB adapter hardware designed by Steven Casagrande (scasagrande@galvant.ca)
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+This code requires the CCS compiler from <https://www.ccsinfo.com/> to compile.
+A pre-compiled hex file is included at
+<https://github.com/steve1515/gpibusb-firmware>
+*****************************************************************************/
+
+
+// Controller Command Table
+// ========================
+// Commands are looked up by name (exact match) using the first character
+// of the name to select a group of table entries (See command_lookup()).
+// Each entry declares the GPIB modes it is allowed in and how its
+// arguments are parsed before the command is handled (See handle_command()).
+// Note: Entries must be grouped by the first character of the name.
+//       The table is stored in program memory.
+//       Included by gpib_usb.c. The table and its lookup (See gpib_cmd.c)
+//       only use standard C, so they can also be built on a host (See test/).
+
+// Command IDs
+#define CMD_ADDR        0
+#define CMD_ADDR_CACHE  1
+#define CMD_ADDR_SAVED  2
+#define CMD_AUTO        3
+#define CMD_BWRITE      4
+#define CMD_CLR         5
+#define CMD_DEBUG       6
+#define CMD_EOI         7
+#define CMD_EOS         8
+#define CMD_EOT_CHAR    9
+#define CMD_EOT_ENABLE  10
+#define CMD_HELP        11
+#define CMD_IFC         12
+#define CMD_LLO         13
+#define CMD_LOC         14
+#define CMD_LON         15
+#define CMD_MODE        16
+#define CMD_OVERFLOW    17
+#define CMD_PPC         18
+#define CMD_PPD         19
+#define CMD_PPOLL       20
+#define CMD_PPU         21
+#define CMD_READ        22
+#define CMD_READ_TMO_MS 23
+#define CMD_RST         24
+#define CMD_SAVECFG     25
+#define CMD_SPOLL       26
+#define CMD_SPSWEEP     27
+#define CMD_SRQ         28
+#define CMD_STATUS      29
+#define CMD_TRG         30
+#define CMD_VER         31
+#define CMD_MACRO       32
+#define CMD_FLOW        33
+#define CMD_STATS       34
+#define CMD_HIST        35
+#define CMD_BAUD        36
+#define CMD_ABORT_IFC   37
+#define CMD_ACK         38
+#define CMD_FINDLSTN    39
+#define CMD_XFER        40
+#define CMD_CMD         41
+#define CMD_BCAST       42
+
+#define CMD_NONE 0xff  // Command not found
+
+// Allowed Modes (Bit positions are MODE_DEVICE and MODE_CONTROLLER)
+#define CMD_MODE_DEVICE     0x01
+#define CMD_MODE_CONTROLLER 0x02
+#define CMD_MODE_ANY        0x03
+
+// Argument Parsers
+#define ARG_NONE     0x00  // Arguments are ignored
+#define ARG_VALUE    0x01  // Optional numeric value (Query if not given)
+#define ARG_ADDRESS  0x02  // Optional address (<PAD> [<SAD>])
+#define ARG_TEXT     0x03  // Optional argument text parsed by the command
+#define ARG_REQUIRED 0x80  // Flag: Argument must be given
+
+#define COMMAND_NAME_LEN 12  // Maximum command name length (including null terminator)
+
+typedef struct
+{
+    char name[COMMAND_NAME_LEN];  // Command name (without '++')
+    uint8_t id;                   // Command ID (CMD_*)
+    uint8_t modes;                // Allowed modes (CMD_MODE_*)
+    uint8_t argType;              // Argument parser (ARG_*)
+} CommandEntry;
+
+const CommandEntry _commandTable[] =
+{
+    // Name           ID               Modes                Arguments
+    { "abort_ifc",    CMD_ABORT_IFC,   CMD_MODE_ANY,        ARG_VALUE },                  // ++abort_ifc [0|1]
+    { "ack",          CMD_ACK,         CMD_MODE_ANY,        ARG_VALUE },                  // ++ack [0|1]
+    { "addr",         CMD_ADDR,        CMD_MODE_ANY,        ARG_ADDRESS },                // ++addr [<PAD> [<SAD>]]
+    { "addr_cache",   CMD_ADDR_CACHE,  CMD_MODE_ANY,        ARG_VALUE },                  // ++addr_cache [0|1]
+    { "addr_saved",   CMD_ADDR_SAVED,  CMD_MODE_ANY,        ARG_VALUE },                  // ++addr_saved [0]
+    { "auto",         CMD_AUTO,        CMD_MODE_CONTROLLER, ARG_VALUE },                  // ++auto [0|1]
+    { "baud",         CMD_BAUD,        CMD_MODE_ANY,        ARG_TEXT },                   // ++baud [<rate>|ok]
+    { "bcast",        CMD_BCAST,       CMD_MODE_CONTROLLER, ARG_TEXT },                   // ++bcast [<PAD1> [<SAD1>] ... [<PAD15> [<SAD15>]]]
+    { "bwrite",       CMD_BWRITE,      CMD_MODE_ANY,        ARG_TEXT | ARG_REQUIRED },    // ++bwrite <count>
+    { "clr",          CMD_CLR,         CMD_MODE_CONTROLLER, ARG_NONE },                   // ++clr
+    { "cmd",          CMD_CMD,         CMD_MODE_CONTROLLER, ARG_TEXT | ARG_REQUIRED },    // ++cmd <Byte1> [<Byte2> ... <Byte40>]
+    { "debug",        CMD_DEBUG,       CMD_MODE_ANY,        ARG_VALUE },                  // ++debug [0|1]
+    { "eoi",          CMD_EOI,         CMD_MODE_ANY,        ARG_VALUE },                  // ++eoi [0|1]
+    { "eos",          CMD_EOS,         CMD_MODE_ANY,        ARG_VALUE },                  // ++eos [0|1|2|3]
+    { "eot_char",     CMD_EOT_CHAR,    CMD_MODE_ANY,        ARG_VALUE },                  // ++eot_char [<char>]
+    { "eot_enable",   CMD_EOT_ENABLE,  CMD_MODE_ANY,        ARG_VALUE },                  // ++eot_enable [0|1]
+    { "findlstn",     CMD_FINDLSTN,    CMD_MODE_CONTROLLER, ARG_TEXT },                   // ++findlstn [sad]
+    { "flow",         CMD_FLOW,        CMD_MODE_ANY,        ARG_VALUE },                  // ++flow [0|1|2]
+    { "help",         CMD_HELP,        CMD_MODE_ANY,        ARG_NONE },                   // ++help
+    { "hist",         CMD_HIST,        CMD_MODE_ANY,        ARG_TEXT },                   // ++hist [0|1|reset]
+    { "ifc",          CMD_IFC,         CMD_MODE_CONTROLLER, ARG_NONE },                   // ++ifc
+    { "llo",          CMD_LLO,         CMD_MODE_CONTROLLER, ARG_NONE },                   // ++llo
+    { "loc",          CMD_LOC,         CMD_MODE_CONTROLLER, ARG_NONE },                   // ++loc
+    { "lon",          CMD_LON,         CMD_MODE_DEVICE,     ARG_VALUE },                  // ++lon [0|1]
+    { "macro",        CMD_MACRO,       CMD_MODE_ANY,        ARG_TEXT },                   // ++macro [rec <slot>|end|run <slot> [<count>]]
+    { "mode",         CMD_MODE,        CMD_MODE_ANY,        ARG_VALUE },                  // ++mode [0|1]
+    { "overflow",     CMD_OVERFLOW,    CMD_MODE_ANY,        ARG_VALUE },                  // ++overflow [0]
+    { "ppc",          CMD_PPC,         CMD_MODE_CONTROLLER, ARG_TEXT | ARG_REQUIRED },    // ++ppc <PAD> [<SAD>] <line> <sense>
+    { "ppd",          CMD_PPD,         CMD_MODE_CONTROLLER, ARG_ADDRESS | ARG_REQUIRED }, // ++ppd <PAD> [<SAD>]
+    { "ppoll",        CMD_PPOLL,       CMD_MODE_CONTROLLER, ARG_NONE },                   // ++ppoll
+    { "ppu",          CMD_PPU,         CMD_MODE_CONTROLLER, ARG_NONE },                   // ++ppu
+    { "read",         CMD_READ,        CMD_MODE_CONTROLLER, ARG_TEXT },                   // ++read [eoi|blk|<char>]
+    { "read_tmo_ms",  CMD_READ_TMO_MS, CMD_MODE_ANY,        ARG_VALUE },                  // ++read_tmo_ms <time>
+    { "rst",          CMD_RST,         CMD_MODE_ANY,        ARG_NONE },                   // ++rst
+    { "savecfg",      CMD_SAVECFG,     CMD_MODE_ANY,        ARG_VALUE },                  // ++savecfg [0|1]
+    { "spoll",        CMD_SPOLL,       CMD_MODE_CONTROLLER, ARG_ADDRESS },                // ++spoll [<PAD> [<SAD>]]
+    { "spsweep",      CMD_SPSWEEP,     CMD_MODE_CONTROLLER, ARG_TEXT | ARG_REQUIRED },    // ++spsweep [rqs] all|<PAD1> [<SAD1>] ... [<PAD15> [<SAD15>]]
+    { "srq",          CMD_SRQ,         CMD_MODE_CONTROLLER, ARG_NONE },                   // ++srq
+    { "stats",        CMD_STATS,       CMD_MODE_ANY,        ARG_TEXT },                   // ++stats [reset]
+    { "status",       CMD_STATUS,      CMD_MODE_DEVICE,     ARG_VALUE },                  // ++status [0-255]
+    { "trg",          CMD_TRG,         CMD_MODE_CONTROLLER, ARG_TEXT },                   // ++trg [[<PAD1> [<SAD1>]] ... [<PAD15> [<SAD15>]]]
+    { "ver",          CMD_VER,         CMD_MODE_ANY,        ARG_NONE },                   // ++ver
+    { "xfer",         CMD_XFER,        CMD_MODE_CONTROLLER, ARG_TEXT | ARG_REQUIRED }     // ++xfer <TPAD> [<TSAD>] <LPAD1> [<LSAD1>] ... [<LPAD15> [<LSAD15>]]
+};
+
+#define COMMAND_COUNT (sizeof(_commandTable) / sizeof(CommandEntry))
+
+// Index of the first command table entry for each first character ('a'-'z')
+// Note: Entry 26 is the end of the table (See command_table_init()).
+uint8_t _commandIndex[27];
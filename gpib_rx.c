@@ -0,0 +1,375 @@
+/*****************************************************************************
+Firmware for Galvant Industries GPIBUSB Adapter Revision 3 & 4
+Copyright (C) 2019  Steve Matos
+
+GPIBUSB adapter hardware designed by Steven Casagrande (scasagrande@galvant.ca)
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+This code requires the CCS compiler from <https://www.ccsinfo.com/> to compile.
+A pre-compiled hex file is included at
+<https://github.com/steve1515/gpibusb-firmware>
+*****************************************************************************/
+
+
+// UART Receive Line Parser
+// ========================
+// Included by gpib_usb.c, which provides the ring buffer and line state
+// (See gpib_rx.h), the CR, LF, ESC, CAN and SP characters, _stats and the
+// abort request flags. Only standard C is used here, so the parser can also
+// be compiled and tested on a host (See test/).
+
+
+void rx_parse_char(char c)
+{
+    // This function adds a character received over USB to the line being
+    // received and adds completed lines to the ring buffer. It is only
+    // called from RDA_isr().
+    //
+    // Parameters:
+    //   [in] c: Character received from the UART
+    
+    
+    // UART Data Notes
+    // ===============
+    //  - All un-escaped LF (0x0a), CR (0x0d), ESC (0x1b), and '+' characters
+    //    are discarded.
+    //
+    //  - Any UART input that starts with an un-escaped '++' character sequence
+    //    is interpreted as a controller command and not transmitted over GPIB.
+    //
+    //  - Only one character is handled per interrupt. The state of the line
+    //    being received is kept across interrupts, so lines sent back-to-back
+    //    by the host are each queued as a separate ring buffer entry.
+    //
+    //  - The write index is only advanced once a complete line is received,
+    //    so the main loop never sees a partially received line.
+    //
+    //  - A controller command line may hold a sequence of commands and device
+    //    data separated by un-escaped ';' characters (batch line). Each
+    //    segment is added to the ring buffer as a separate entry, so the
+    //    main loop runs the whole sequence in order. A controller command
+    //    segment ends at an un-escaped ';'. A device data segment ends at an
+    //    un-escaped ';' followed by '++' (other ';' characters are data).
+    //    Un-escaped spaces at the start of a segment following ';' are
+    //    discarded. A binary write command must be the last segment of a line.
+    //
+    //  - If a line does not fit in the ring buffer (or a controller command
+    //    is longer than COMMAND_MAX_LEN), the remainder of the line is
+    //    discarded and the overflow counter is incremented.
+    //
+    //  - After a binary write command line (++bwrite <count>), the following
+    //    <count> bytes are not escaped or interpreted and are added to the
+    //    ring buffer as binary data entries (CCF = 2) of up to RAW_CHUNK_LEN
+    //    bytes. If the command line ends with CR, a following LF is treated
+    //    as part of the line termination. If binary data does not fit in the
+    //    ring buffer, the remainder of the binary data is discarded.
+    //
+    //  - An un-escaped CAN (0x18) character is not added to any line. It
+    //    discards the line being received and requests an abort of the
+    //    current operation (See handle_abort()). CAN is not recognized in
+    //    binary data.
+    
+    
+    // Handle binary data following a binary write command
+    if (_rxRawMode)
+    {
+        if (_rxRawSkipLf)
+        {
+            _rxRawSkipLf = false;
+            if (c == LF)
+                return;
+        }
+        
+        _rxRawCount--;
+        
+        if (!_rxDiscard)
+        {
+            // Discard the remaining binary data if the ring buffer is full
+            if ((uint8_t)(_ringBufferRead - _rxWriteIndex - 1) < ((_rxByteLen == 0) ? 3 : 1))
+            {
+                _rxDiscard = true;
+                _rxOverflowCount++;
+            }
+            else
+            {
+                if (_rxByteLen == 0)
+                    _rxWriteIndex += 2;
+                
+                ring_buffer_put(_rxWriteIndex, c);
+                _rxWriteIndex++;
+                _rxByteLen++;
+            }
+        }
+        
+        // Add binary data to the ring buffer once the entry is full or
+        // all binary data has been received
+        if (_rxByteLen == RAW_CHUNK_LEN || _rxRawCount == 0)
+        {
+            if (!_rxDiscard && _rxByteLen > 0)
+            {
+                uint8_t lenIndex = _ringBufferWrite + 1;
+                
+                ring_buffer_put(_ringBufferWrite, CCF_BINARY);
+                ring_buffer_put(lenIndex, _rxByteLen);
+                _ringBufferWrite = _rxWriteIndex;
+            }
+            
+            _rxWriteIndex = _ringBufferWrite;
+            _rxByteLen = 0;
+            
+            // Return to line mode once all binary data has been received
+            if (_rxRawCount == 0)
+            {
+                _rxDiscard = false;
+                _rxRawMode = false;
+            }
+        }
+        
+        return;
+    }
+    
+    // Request abort if un-escaped CAN is received
+    // Note: GPIB transfer loops check the abort request flag, so the abort
+    //       takes effect without waiting for the main loop.
+    if (!_rxEscapeNext && c == CAN)
+    {
+        _abortRequest = true;
+        _abortFlushIndex = _ringBufferWrite;
+        
+        // Discard line being received
+        _rxWriteIndex = _ringBufferWrite;
+        _rxByteLen = 0;
+        _rxCharCount = 0;
+        _rxDiscard = false;
+        _rxBatch = false;
+        _rxSplitCount = 0;
+        _rxRawMatch = 0;
+        _rxRawLength = 0;
+        return;
+    }
+    
+    // Skip un-escaped spaces at the start of a segment following a ';' in a batch line
+    if (_rxBatch && _rxCharCount == 0 && !_rxEscapeNext && c == SP)
+        return;
+    
+    // Save 1st and 2nd characters received.
+    // Note: These characters will be used later to determine if the received
+    //       string (or batch line segment) is a controller command.
+    if (_rxCharCount < 2)
+    {
+        _rxCharCount++;
+        
+        if (_rxCharCount == 1)
+            _rxChar1 = c;
+        else
+            _rxChar2 = c;
+    }
+    
+    // If the escape flag is not set and an escape character is
+    // received, set the escape flag for the next character.
+    // Note: Checking that the escape flag is not set,
+    //       allows escaping of the escape character.
+    if (!_rxEscapeNext && c == ESC)
+    {
+        _rxEscapeNext = true;
+        return;
+    }
+    
+    // Discard un-escaped '+' characters
+    if (!_rxEscapeNext && c == '+')
+    {
+        // End a batch line data segment at ';' followed by '++'
+        if (_rxSplitCount > 0 && ++_rxSplitCount == 3)
+        {
+            // Remove the ';' from the data and add the data to the ring buffer
+            _rxWriteIndex--;
+            _rxByteLen--;
+            rx_entry_add(false);
+            
+            // Start a controller command segment
+            _rxCharCount = 2;
+            _rxChar1 = '+';
+            _rxChar2 = '+';
+            _rxSplitCount = 0;
+            _rxRawMatch = 0;
+            _rxRawLength = 0;
+        }
+        
+        return;
+    }
+    
+    // Complete the line if un-escaped termination character (CR or LF) is received
+    if (!_rxEscapeNext && (c == CR || c == LF))
+    {
+        // Set controller command flag if first two characters received were '++'.
+        // Enter binary mode if the line ends with a binary write command with a byte count.
+        if (rx_entry_add(_rxChar1 == '+' && _rxChar2 == '+')
+            && (_rxRawMatch == RAW_MATCH_COUNT || _rxRawMatch == RAW_MATCH_DONE) && _rxRawLength > 0)
+        {
+            _rxRawCount = _rxRawLength;
+            _rxRawSkipLf = (c == CR);
+            _rxRawMode = true;
+        }
+        
+        // Reset line state for the next line
+        _rxCharCount = 0;
+        _rxDiscard = false;
+        _rxRawMatch = 0;
+        _rxRawLength = 0;
+        _rxBatch = false;
+        _rxSplitCount = 0;
+        return;
+    }
+    
+    // End a controller command segment if un-escaped ';' is received
+    // Note: The rest of the line is handled as a batch line.
+    if (!_rxEscapeNext && c == ';' && _rxChar1 == '+' && _rxChar2 == '+')
+    {
+        rx_entry_add(true);
+        
+        // Reset segment state for the next segment
+        _rxBatch = true;
+        _rxCharCount = 0;
+        _rxRawMatch = 0;
+        _rxRawLength = 0;
+        return;
+    }
+    
+    bool escaped = _rxEscapeNext;
+    _rxEscapeNext = false;
+    
+    // Any character other than '+' cancels a pending batch line data segment split
+    _rxSplitCount = 0;
+    
+    // Do nothing if the current line is being discarded
+    if (_rxDiscard)
+        return;
+    
+    // Discard the line if the ring buffer does not have room for the character.
+    // Note: The first character also requires room for the controller command
+    //       flag and data length bytes. The pointers are never allowed to
+    //       become equal unless the buffer is empty, so there is always
+    //       at least one free byte.
+    if ((uint8_t)(_ringBufferRead - _rxWriteIndex - 1) < ((_rxByteLen == 0) ? 3 : 1))
+    {
+        _rxDiscard = true;
+        _rxOverflowCount++;
+        return;
+    }
+    
+    // Discard controller commands that are too long to be used in place
+    if (_rxChar1 == '+' && _rxChar2 == '+' && _rxByteLen >= COMMAND_MAX_LEN)
+    {
+        _rxDiscard = true;
+        _rxOverflowCount++;
+        return;
+    }
+    
+    // Before adding the first character to the buffer below,
+    // advance the ring buffer write pointer 2 positions.
+    // Note: The 1st and 2nd bytes are used for the controller command flag
+    //       and data length size respectively.
+    if (_rxByteLen == 0)
+        _rxWriteIndex += 2;
+    
+    // Add character to buffer (if escaped or a character other then ESC, '+', CR, LF)
+    ring_buffer_put(_rxWriteIndex, c);
+    _rxWriteIndex++;
+    _rxByteLen++;
+    
+    // A ';' in a batch line data segment ends the segment if followed by '++'
+    if (_rxBatch && !escaped && c == ';')
+        _rxSplitCount = 1;
+    
+    // Match binary write command (++bwrite <count>) and its byte count
+    // as characters are received.
+    // Note: The byte count is built one digit per interrupt to keep the
+    //       time spent at the end of the line short.
+    if (_rxChar1 != '+' || _rxChar2 != '+' || _rxRawMatch == RAW_MATCH_NONE)
+        return;
+    
+    if (_rxRawMatch < 6)  // Match command name
+    {
+        _rxRawMatch = (c == _rxRawCommand[_rxRawMatch]) ? _rxRawMatch + 1 : RAW_MATCH_NONE;
+    }
+    else if (_rxRawMatch == 6)  // Match space following command name
+    {
+        _rxRawMatch = (c == SP) ? RAW_MATCH_COUNT : RAW_MATCH_NONE;
+    }
+    else if (_rxRawMatch == RAW_MATCH_COUNT)  // Get byte count digits
+    {
+        if (c >= '0' && c <= '9')
+            _rxRawLength = (_rxRawLength << 3) + (_rxRawLength << 1) + (c - '0');
+        else if (_rxRawLength > 0)
+            _rxRawMatch = RAW_MATCH_DONE;
+        else if (c != SP)
+            _rxRawMatch = RAW_MATCH_NONE;
+    }
+}
+
+
+bool rx_entry_add(bool isCommand)
+{
+    // This function adds the line (or batch line segment) being received to
+    // the ring buffer and resets the write state for the next entry.
+    // It is only called from rx_parse_char().
+    //
+    // Parameters:
+    //   [in] isCommand: True = entry is a controller command (CCF = 1)
+    //
+    // Return Value: True = entry was added; False = no data or discarded
+    
+    
+    bool added = false;
+    
+    // Add null terminator to controller commands (Discard the line if there is no room)
+    if (isCommand && !_rxDiscard && _rxByteLen > 0)
+    {
+        if ((uint8_t)(_ringBufferRead - _rxWriteIndex - 1) < 1)
+        {
+            _rxDiscard = true;
+            _rxOverflowCount++;
+        }
+        else
+        {
+            ring_buffer_put(_rxWriteIndex, '\0');
+            _rxWriteIndex++;
+            _rxByteLen++;
+        }
+    }
+    
+    // Only add the entry to the ring buffer if data was received and
+    // the line was not discarded
+    if (!_rxDiscard && _rxByteLen > 0)
+    {
+        uint8_t lenIndex = _ringBufferWrite + 1;
+        
+        // Set controller command flag
+        ring_buffer_put(_ringBufferWrite, isCommand ? CCF_COMMAND : CCF_DATA);
+        
+        // Set data byte length
+        ring_buffer_put(lenIndex, _rxByteLen);
+        
+        // Make the entry available to the main loop
+        _ringBufferWrite = _rxWriteIndex;
+        _stats.linesReceived++;
+        added = true;
+    }
+    
+    _rxWriteIndex = _ringBufferWrite;
+    _rxByteLen = 0;
+    
+    return added;
+}
@@ -0,0 +1,86 @@
+/*****************************************************************************
+Firmware for Galvant Industries GPIBUSB Adapter Revision 3 & 4
+Copyright (C) 2019  Steve Matos
+
+GPIBUSB adapter hardware designed by Steven Casagrande (scasagrande@galvant.ca)
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Affero General Public License as
+published by the Free Software Foundation, either version 3 of the
+License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+This code requires the CCS compiler from <https://www.ccsinfo.com/> to compile.
+A pre-compiled hex file is included at
+<https://github.com/steve1515/gpibusb-firmware>
+*****************************************************************************/
+
+
+// UART Receive Ring Buffer and Line Parser State
+// ==============================================
+// Included by gpib_usb.c. The parser (See gpib_rx.c) only uses standard C,
+// so it can also be compiled and tested on a host (See test/).
+
+
+// Note: UART receive ring buffer length of 256 allows for easy rollover of indexes.
+//       Do not change buffer length!
+#define BUFFER_LEN 256
+
+// The first RING_MIRROR_LEN bytes of the ring buffer are mirrored after its end,
+// so ring buffer entries of up to RING_MIRROR_LEN bytes can be used in place
+// even when they wrap around the end of the ring buffer (See ring_buffer_put()).
+#define RING_MIRROR_LEN 128
+
+// Maximum controller command length
+// Note: Command entries (CCF + DLEN + Command + Null Terminator) must fit in the mirror.
+#define COMMAND_MAX_LEN (RING_MIRROR_LEN - 3)
+
+// Control Command Flag (CCF) Values (See RDA_isr())
+#define CCF_DATA    0x00  // Device data
+#define CCF_COMMAND 0x01  // Controller command
+#define CCF_BINARY  0x02  // Binary data (See ++bwrite command)
+uint8_t _ringBuffer[BUFFER_LEN + RING_MIRROR_LEN];
+volatile uint8_t _ringBufferRead = 0;   // Start of entries in use (Released by main loop)
+volatile uint8_t _ringBufferWrite = 0;
+uint8_t _ringBufferNext = 0;            // Next entry to be read by main loop (See buffer_get())
+
+// Stores a byte in the ring buffer and its mirror
+#define ring_buffer_put(index, value) \
+{ \
+    _ringBuffer[index] = (value); \
+    if ((index) < RING_MIRROR_LEN) \
+        _ringBuffer[BUFFER_LEN + (index)] = (value); \
+}
+
+// UART receive line state (kept across RDA interrupts)
+uint8_t _rxWriteIndex = 0;     // Ring buffer index of next byte for the line being received
+uint8_t _rxByteLen = 0;        // Number of data bytes stored for the line being received
+uint8_t _rxCharCount = 0;      // Number of characters received for the line (saturates at 2)
+char _rxChar1 = '\0';          // 1st character received for the line
+char _rxChar2 = '\0';          // 2nd character received for the line
+bool _rxEscapeNext = false;    // True = next character is escaped
+bool _rxDiscard = false;       // True = line overflowed the ring buffer and is being discarded
+bool _rxBatch = false;         // True = line is a batch line (Command segment ended with ';')
+uint8_t _rxSplitCount = 0;     // Batch line data segment split state (1 = ';' received, 2 = ';+' received)
+volatile uint16_t _rxOverflowCount = 0;  // Number of lines discarded due to a full ring buffer
+
+// UART receive binary data state (See ++bwrite command)
+#define RAW_CHUNK_LEN     64    // Maximum number of binary data bytes per ring buffer entry
+#define RAW_MATCH_COUNT   7     // Binary write command matched, receiving byte count
+#define RAW_MATCH_DONE    8     // Binary write command byte count received
+#define RAW_MATCH_NONE    0xff  // Line is not a binary write command
+
+const char _rxRawCommand[] = "bwrite";  // Binary write command name matched by RDA_isr()
+
+uint8_t _rxRawMatch = 0;         // Number of binary write command characters matched (or RAW_MATCH_*)
+uint32_t _rxRawLength = 0;       // Byte count given with binary write command
+uint32_t _rxRawCount = 0;        // Number of binary data bytes remaining
+volatile bool _rxRawMode = false;  // True = receiving binary data
+bool _rxRawSkipLf = false;       // True = skip LF following a CR terminated binary write command
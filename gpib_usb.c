@@ -56,8 +56,12 @@ A pre-compiled hex file is included at
 #define CR  0x0d  // Carriage Return
 #define LF  0x0a  // Line Feed
 #define ESC 0x1b  // Escape
+#define CAN 0x18  // Cancel (Abort)
+#define ACK 0x06  // Acknowledge
 #define TAB 0x09  // Tab
 #define SP  0x20  // Space
+#define XON  0x11  // Resume Transmission (DC1)
+#define XOFF 0x13  // Pause Transmission (DC3)
 
 
 // GPIB Command Bytes (See IEEE 488.1 and IEEE 488.2)
@@ -81,6 +85,12 @@ A pre-compiled hex file is included at
 
 #define CONTROLLER_ADDR 0  // Controller GPIB address (always zero)
 
+#define LISTEN_LIST_MAX 15  // Maximum number of devices in a listen address list
+#define CMD_BYTES_MAX   40  // Maximum number of command bytes sent by ++cmd
+
+#define LISTENER_SENSE_TICKS  58  // Timer1 ticks (100 uSec) to sense NDAC after listen addressing (See gpib_find_listener())
+#define LISTENER_SETTLE_TICKS 6   // Timer1 ticks (10 uSec) NDAC must stay high to report no listener
+
 #define MODE_DEVICE     0
 #define MODE_CONTROLLER 1
 
@@ -89,18 +99,141 @@ A pre-compiled hex file is included at
 #define EOS_LF    2
 #define EOS_NONE  3
 
+#define FLOW_NONE     0  // No flow control
+#define FLOW_XON_XOFF 1  // Software flow control (XON/XOFF characters)
+#define FLOW_RTS_CTS  2  // Hardware flow control (Requires HOST_CTS pin, see gpib_usb.h)
+
 #define READ_TO_TIMEOUT 0
 #define READ_TO_EOI     1
 #define READ_TO_CHAR    2
+#define READ_TO_BLOCK   3
+
+// Definite Length Block States (READ_TO_BLOCK read mode)
+#define BLOCK_PREFIX  0  // Waiting for '#'
+#define BLOCK_DIGITS  1  // Waiting for number of length digits
+#define BLOCK_LENGTH  2  // Receiving length digits
+#define BLOCK_DATA    3  // Receiving block data
+#define BLOCK_END     4  // Block complete (Discarding message terminator)
+
+
+// Timer0 is a free-running 16-bit timebase used for handshake timeouts.
+// Timer0 Tick = 18.432 MHz / 4 / 256 = 18 kHz (55.6 uSec)
+// Note: The 16-bit timer rolls over every 3.64 seconds, so timeouts must be
+//       less than this value (Maximum timeout of 3000 mSec = 54000 ticks).
+#define TIMER_TICKS_PER_MS 18
+
+// Returns the number of Timer0 ticks elapsed since the given start time
+#define timer_elapsed(start) ((uint16_t)(get_timer0() - (start)))
+
+
+#include "gpib_rx.h"  // UART receive ring buffer and line parser state
+
+// USB flow control watermarks (Number of bytes used in the receive ring buffer)
+// Note: The host is paused at the high watermark and resumed at the low
+//       watermark. The space above the high watermark allows for characters
+//       already sent by the host before it is paused.
+#define FLOW_HIGH_WATERMARK 192
+#define FLOW_LOW_WATERMARK  64
+
+// USB UART Baud Rates (See ++baud command)
+// Baud Rate = 18.432 MHz / (4 * (Divisor + 1))  [BRG16 = 1, BRGH = 1]
+#define BAUD_DEFAULT        0     // Index of default baud rate (460800)
+#define BAUD_COUNT          3     // Number of baud rates
+#define BAUD_CONFIRM_TICKS  (1000 * TIMER_TICKS_PER_MS)  // Time to wait for host confirmation (1 Sec)
+
+const uint32_t _baudRate[BAUD_COUNT] = { 460800, 921600, 1152000 };
+const uint8_t _baudDivisor[BAUD_COUNT] = { 9, 4, 3 };
+uint8_t _baudIndex = BAUD_DEFAULT;  // Index of current baud rate
+
+// Out-of-Band Abort (See RDA_isr() and handle_abort())
+volatile bool _abortRequest = false;  // True = abort requested by host (CAN received)
+uint8_t _abortFlushIndex = 0;         // Ring buffer write index when abort was requested
+bool _abortIfc = false;               // True = send IFC after an abort (controller mode)
+
+// Completion Record Status Codes (See ++ack command)
+#define ACK_OK            0  // Completed successfully
+#define ACK_ERROR         1  // Command not recognized, missing argument or not allowed
+#define ACK_BAD_ADDRESS   2  // Device address invalid or out of range
+#define ACK_NO_LISTENERS  3  // No listeners on the bus (NRFD and NDAC both high, or addressed device not listening)
+#define ACK_TIMEOUT_NRFD  4  // Timeout waiting for listeners to be ready for data (NRFD)
+#define ACK_TIMEOUT_NDAC  5  // Timeout waiting for listeners to accept data (NDAC)
+#define ACK_TIMEOUT_DAV   6  // Timeout waiting for talker (DAV)
+#define ACK_ABORTED       7  // Aborted by host (CAN)
+
+bool _ackEnable = false;      // True = output a completion record after each line
+uint8_t _ackStatus = ACK_OK;  // Status of the line being handled (ACK_*)
+uint32_t _ackCount = 0;       // Number of bytes read for the line being handled
+
+uint8_t _flowControl = FLOW_NONE;  // USB flow control mode (FLOW_*)
+volatile bool _rxPaused = false;   // True = host has been paused by flow control
+volatile char _txFlowChar = 0;     // XON/XOFF character to send before queued output (0 = none)
 
+// Runtime Statistics (See ++stats command)
+// Note: Counters are only incremented, so wrap around is handled by
+//       computing differences between readings.
+typedef struct
+{
+    uint32_t gpibBytesSent;      // Device data bytes sent on GPIB
+    uint32_t gpibBytesReceived;  // Bytes received on GPIB
+    uint32_t gpibCommandBytes;   // GPIB command (ATN) bytes sent (e.g. addressing)
+    uint32_t linesReceived;      // Lines (or batch line segments) received over USB (Updated in RDA_isr())
+    uint16_t nrfdTimeouts;       // Timeouts waiting for NRFD high in gpib_send()
+    uint16_t ndacTimeouts;       // Timeouts waiting for NDAC high in gpib_send()
+    uint16_t davTimeouts;        // Timeouts waiting for DAV in gpib_receive_handshake()
+    uint16_t eepromWrites;       // EEPROM bytes written by update_eeprom()
+    uint8_t rxBufferMax;         // Maximum receive ring buffer occupancy in bytes (Updated in RDA_isr())
+} Statistics;
+
+Statistics _stats;
+
+// Handshake Latency Histograms (See ++hist command)
+// Waits in each handshake phase are timed with Timer1 and counted in
+// log-scale bins per device address (PAD). Histograms are kept for up to
+// HIST_SLOTS addresses, assigned in order of first use. PAD 0 is used for
+// GPIB commands (ATN) and for all transfers in device mode.
+//
+// Timer1 Tick = 18.432 MHz / 4 / 8 = 576 kHz (1.74 uSec)
+// Bin 0 = 0 ticks; Bin N = 4^(N-1) to 4^N - 1 ticks; Bin 7 = 4096 ticks (7.1 mSec) or more
+#define HIST_SLOTS      4     // Number of addresses with histograms
+#define HIST_PHASES     4     // Number of handshake phases
+#define HIST_BINS       8     // Number of bins per phase
+#define HIST_LONG_TICKS 128   // Timer0 ticks (7.1 mSec) after which waits go in the last bin
+#define HIST_NO_PAD     0xff  // Histogram slot is not used
+
+#define HIST_NRFD_HIGH  0  // Send: Data placed on bus until listeners ready (NRFD high)
+#define HIST_NDAC_HIGH  1  // Send: DAV asserted until listeners accept data (NDAC high)
+#define HIST_DAV_LOW    2  // Receive: Ready for data (NRFD high) until talker asserts DAV
+#define HIST_DAV_HIGH   3  // Receive: Data accepted (NDAC high) until talker releases DAV
+
+bool _histEnable = false;               // True = record handshake latency histograms
+uint8_t _histPad = 0;                   // PAD of device being addressed (See gpib_send_setup())
+uint16_t _histStartT1 = 0;              // Timer1 value at start of wait
+uint16_t _histStartT0 = 0;              // Timer0 value at start of wait
+uint8_t _histSlotPad[HIST_SLOTS];       // PAD of each histogram slot
+uint16_t _hist[HIST_SLOTS][HIST_PHASES][HIST_BINS];
+
+// Marks the start of a handshake wait
+#define hist_start() \
+{ \
+    if (_histEnable) \
+    { \
+        _histStartT1 = get_timer1(); \
+        _histStartT0 = get_timer0(); \
+    } \
+}
+
+// Records the end of a handshake wait
+#define hist_stop(pad, phase) \
+{ \
+    if (_histEnable) \
+        hist_record(pad, phase); \
+}
 
-// Note: UART receive ring buffer length of 256 allows for easy rollover of indexes.
-//       Do not change buffer length!
-#define BUFFER_LEN 256
-uint8_t _ringBuffer[BUFFER_LEN];
-uint8_t _recvBuffer[BUFFER_LEN];
-volatile uint8_t _ringBufferRead = 0;
-volatile uint8_t _ringBufferWrite = 0;
+// Note: UART transmit ring buffer length must be a power of two (256 maximum).
+#define TX_BUFFER_LEN 256
+uint8_t _txBuffer[TX_BUFFER_LEN];
+volatile uint8_t _txBufferRead = 0;
+volatile uint8_t _txBufferWrite = 0;
 
 bool _debugMode = false;  // True = display user-level debugging messages
 
@@ -122,78 +255,124 @@ bool _listenOnlyMode = false;
 uint8_t _deviceStatusByte = 0x00;
 bool _saveCfgEnable = false;
 
-uint16_t _gpibTimeout = 1000;
-uint16_t _mSecTimer = 0;
+uint16_t _gpibTimeout = 1000;       // Handshake timeout (mSec)
+uint16_t _gpibTimeoutTicks = 18000;  // Handshake timeout (Timer0 ticks)
 
 char _eosBuffer[] = "\r\n";
 
+// Bus Addressing State Variables (Controller Mode)
+// Note: The current talker and listener are tracked so that addressing
+//       sequences already in effect on the bus can be skipped.
+//       The listener is only tracked when a single device (or only the
+//       controller) is addressed to listen.
+#define BUS_ADDR_UNKNOWN 0xff  // Bus addressing state is not known
+#define BUS_NO_SAD       0xff  // Address has no secondary address
+
+uint8_t _bcastList[LISTEN_LIST_MAX * 2];  // Listen address command bytes for the next data line (See ++bcast)
+uint8_t _bcastLength = 0;                 // Number of bytes in _bcastList (0 = not armed)
+
+bool _addrCacheEnable = true;                  // True = skip addressing already in effect
+uint8_t _busTalkerPad = BUS_ADDR_UNKNOWN;      // PAD of current talker
+uint8_t _busTalkerSad = BUS_NO_SAD;            // SAD of current talker
+uint8_t _busListenerPad = BUS_ADDR_UNKNOWN;    // PAD of current listener
+uint8_t _busListenerSad = BUS_NO_SAD;          // SAD of current listener
+bool _serialPollActive = false;                // True = serial poll enabled (SPE sent) and not yet disabled (SPD)
+uint32_t _addrBytesSaved = 0;                  // Number of command bytes skipped
+
 // Device Mode State Variables
 bool _deviceTalk = false;        // True = device addressed as talker
 bool _deviceListen = false;      // True = device addressed as listener
 bool _deviceSerialPoll = false;  // True = serial poll mode enabled
 
+// Macro Store
+// Macros are sequences of controller commands and device data stored in
+// EEPROM slots following the configuration area (See ++macro command).
+// Slot Format: | Used Length | Entry 1 | Entry 2 | ... |
+// Each entry uses the ring buffer entry format (CCF + DLEN + Data).
+#define MACRO_EEPROM_START 0x20  // EEPROM address of first slot
+#define MACRO_SLOT_COUNT   4     // Number of slots
+#define MACRO_SLOT_LEN     56    // Slot length in bytes (Including used length byte)
+#define MACRO_NONE         0xff  // No macro is being recorded
 
-// Prologix Compatible Command Set
-char _cmdAddr[]      = "addr";         // ++addr [<PAD> [<SAD>]]
-char _cmdAuto[]      = "auto";         // ++auto [0|1]
-char _cmdClr[]       = "clr";          // ++clr
-char _cmdEoi[]       = "eoi";          // ++eoi [0|1]
-char _cmdEos[]       = "eos";          // ++eos [0|1|2|3]
-char _cmdEotEnable[] = "eot_enable";   // ++eot_enable [0|1]
-char _cmdEotChar[]   = "eot_char";     // ++eot_char [<char>]
-char _cmdIfc[]       = "ifc";          // ++ifc
-char _cmdLlo[]       = "llo";          // ++llo
-char _cmdLoc[]       = "loc";          // ++loc
-char _cmdLon[]       = "lon";          // ++lon [0|1]
-char _cmdMode[]      = "mode";         // ++mode [0|1]
-char _cmdReadTmoMs[] = "read_tmo_ms";  // ++read_tmo_ms <time>
-char _cmdRead[]      = "read";         // ++read [eoi|<char>]
-char _cmdRst[]       = "rst";          // ++rst
-char _cmdSavecfg[]   = "savecfg";      // ++savecfg [0|1]
-char _cmdSpoll[]     = "spoll";        // ++spoll [<PAD> [<SAD>]]
-char _cmdSrq[]       = "srq";          // ++srq
-char _cmdStatus[]    = "status";       // ++status [0-255]
-char _cmdTrg[]       = "trg";          // ++trg [[<PAD1> [<SAD1>]] [<PAD2> [<SAD2>]] ... [<PAD15> [<SAD15>]]]
-char _cmdVer[]       = "ver";          // ++ver
-char _cmdHelp[]      = "help";         // ++help
-
-// Additional Commands
-char _cmdDebug[]     = "debug";        // ++debug [0|1]
+uint8_t _macroRecordSlot = MACRO_NONE;  // Slot being recorded
+uint8_t _macroRecordLength = 0;         // Number of bytes recorded
+bool _macroRecordError = false;         // True = macro did not fit in slot
+uint8_t _macroBuffer[MACRO_SLOT_LEN];   // Entry being replayed
+uint8_t _macroRunSlot = MACRO_NONE;     // Slot to be replayed by main loop
+uint32_t _macroRunCount = 0;            // Number of times to replay the macro
+
+
+#include "gpib_cmd.h"  // Controller command table
 
 
 #define debug_printf(fmt, ...) do {\
     if (_debugMode)\
     {\
-        printf((fmt), ##__VA_ARGS__);\
-        if (_eotEnable) printf("%c", _eotChar);\
+        printf(tx_putc, (fmt), ##__VA_ARGS__);\
+        if (_eotEnable) tx_putc(_eotChar);\
     }\
 } while (0)
 
 
 #define eot_printf(fmt, ...) do {\
-    printf((fmt), ##__VA_ARGS__);\
-    if (_eotEnable) printf("%c", _eotChar);\
+    printf(tx_putc, (fmt), ##__VA_ARGS__);\
+    if (_eotEnable) tx_putc(_eotChar);\
 } while (0)
 
 
-bool buffer_get(uint8_t *buffer);
+#inline void rx_parse_char(char c);
+bool rx_entry_add(bool isCommand);
+void tx_putc(char c);
+void tx_flush();
+void flow_resume();
+void handle_abort();
+#inline void ack_status(uint8_t status);
+void ack_report();
+void uart_set_baud(uint8_t index);
+void uart_change_baud(uint8_t index);
+uint8_t* buffer_get();
+void buffer_release();
 char* trim_right(char *str);
 char* get_address(char *buffer, uint8_t *pad, uint8_t *sad, uint8_t *validSad);
+void command_table_init();
+uint8_t command_lookup(char *name);
 void handle_command(uint8_t *buffer);
+void handle_data(uint8_t *buffer, uint8_t length);
+void handle_binary_write(uint32_t length);
+void macro_record_begin(uint8_t slot);
+void macro_record_end();
+void macro_record_byte(uint8_t value);
+void macro_record_data(uint8_t index, uint8_t length);
+void macro_record_command(char *name, char *args);
+void macro_run();
 void handle_device_mode();
 void handle_listen_only_mode();
 #inline void update_eeprom(int8_t address, int8_t value);
 void eeprom_read_cfg();
 void eeprom_write_cfg();
+void hist_record(uint8_t pad, uint8_t phase);
+void hist_reset();
 void gpib_init_pins(uint8_t mode);
 #inline void gpib_send_ifc();
+void gpib_bus_state_clear();
 bool gpib_read_status_byte(uint8_t *statusByte, uint8_t pad, uint8_t sad, bool useSad);
+bool gpib_serial_poll_begin();
+bool gpib_serial_poll_device(uint8_t *statusByte, uint8_t pad, uint8_t sad, bool useSad);
+bool gpib_serial_poll_end();
+bool gpib_parallel_poll(uint8_t *response);
 #inline bool gpib_send_command(uint8_t command);
 #inline bool gpib_send_data(uint8_t *buffer, uint8_t length, bool useEoi);
+bool gpib_send_entry(uint8_t *buffer, uint8_t length, bool useEoi);
 bool gpib_send_setup(uint8_t pad, uint8_t sad, bool useSad);
+bool gpib_send_setup_list(uint8_t *listBuffer, uint8_t listLength);
+bool gpib_find_listener();
+bool gpib_sense_listener();
+uint8_t gpib_listen_list(char *buffer, uint8_t *cmdBuffer);
 bool gpib_send(uint8_t *buffer, uint8_t length, bool isCommand, bool useEoi);
 bool gpib_receive_setup(uint8_t pad, uint8_t sad, bool useSad);
 bool gpib_receive_byte(char *buffer, uint8_t *eoiStatus);
+void gpib_receive_start();
+bool gpib_receive_handshake(char *buffer, uint8_t *eoiStatus);
 void gpib_receive_data(uint8_t readMode, char readToChar);
 
 
@@ -233,14 +412,26 @@ void main()
     // Setup watchdog timer
     setup_wdt(WDT_ON);
     
-    // Setup timeout timer
-    set_rtcc(0);
-    setup_timer_2(T2_DIV_BY_16, 144, 2);  // 1 mSec interrupt
+    // Setup free-running timeout timer (16-bit, 55.6 uSec tick)
+    setup_timer_0(RTCC_INTERNAL | RTCC_DIV_256);
     enable_interrupts(GLOBAL);
-    disable_interrupts(INT_TIMER2);
+    
+    // Setup handshake latency timer (16-bit, 1.74 uSec tick)
+    setup_timer_1(T1_INTERNAL | T1_DIV_BY_8);
+    
+    // Clear runtime statistics and histograms
+    memset(&_stats, 0, sizeof(Statistics));
+    hist_reset();
     
     // Read EEPROM configuration values
     eeprom_read_cfg();
+    
+    // Start at the default UART baud rate (See below)
+    uint8_t baudIndex = _baudIndex;
+    uart_set_baud(BAUD_DEFAULT);
+    
+    // Build command table index
+    command_table_init();
 
     // Initialize GPIB bus lines
     gpib_init_pins(_gpibMode);
@@ -259,55 +450,70 @@ void main()
     output_high(LED_ERROR);
     restart_wdt(); delay_ms(100);
     
+#ifdef HOST_CTS
+    // Allow the host to send
+    output_low(HOST_CTS);
+#endif
+    
     enable_interrupts(INT_RDA);
     restart_wdt();
     output_low(LED_ERROR);
     
+    // Switch to the saved UART baud rate. The host has to confirm it the
+    // same way as a ++baud command, otherwise the default rate is kept.
+    if (baudIndex != BAUD_DEFAULT)
+        uart_change_baud(baudIndex);
+    
     // Main Loop
     for (;;)
     {
         restart_wdt();
         
+        // Handle out-of-band abort from host
+        if (_abortRequest)
+            handle_abort();
+        
         // Check for data in UART receive buffer and process as required
-        if (buffer_get(_recvBuffer))
+        // Note: Entries are used in place and released once processed.
+        uint8_t *pEntry = buffer_get();
+        
+        if (pEntry != NULL)
         {
+            _ackStatus = ACK_OK;
+            _ackCount = 0;
+            
+            // Binary data entries are only expected by a binary write command,
+            // so stray entries are discarded without a completion record.
+            bool ackEntry = (pEntry[0] != CCF_BINARY);
+            
             // Check if the received data is a controller command sequence (++ command)
-            // Note: First byte in receive buffer is the control
+            // Note: First byte of the entry is the control
             //       command flag (CCF). If CCF == 1, then data is a command.
-            if (_recvBuffer[0])
+            if (pEntry[0] == CCF_COMMAND)
             {
-                handle_command(_recvBuffer);
+                handle_command(pEntry);
             }
-            else  // Not an internal controller command sequence
+            else if (pEntry[0] == CCF_DATA)  // Not an internal controller command sequence
             {
-                uint8_t dataLen = _recvBuffer[1];
-                uint8_t *pBuf = _recvBuffer+2;
+                uint8_t dataLen = pEntry[1];
+                uint8_t dataIndex = _ringBufferNext - dataLen;
                 
-                if (_gpibMode == MODE_CONTROLLER)
-                {
-                    bool errorStatus = false;
-                    
-                    // Address target device and send data
-                    errorStatus = errorStatus || gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
-                    errorStatus = errorStatus || gpib_send_data(pBuf, dataLen, _useEoi);
-                    
-                    // Automatically read after sending data if auto read mode is enabled
-                    if (_autoRead)
-                    {
-                        errorStatus = errorStatus || gpib_receive_setup(_devicePad, _deviceSad, _useDeviceSad);
-                        if (!errorStatus)
-                            gpib_receive_data(READ_TO_EOI, NULL);
-                    }
-                }
-                else  // Device mode
-                {
-                    // Sending data is only allowed when addressed to talk,
-                    // serial poll mode disabled, and ATN deasserted.
-                    // Reference: IEEE 488.1-1987 - Section 2.5.2 T Function State Diagrams
-                    if (_deviceTalk && !_deviceSerialPoll && input(ATN))
-                        gpib_send_data(pBuf, dataLen, _useEoi);
-                }
+                // Record data instead of sending it while a macro is being recorded
+                if (_macroRecordSlot != MACRO_NONE)
+                    macro_record_data(dataIndex, dataLen);
+                else
+                    handle_data(&_ringBuffer[dataIndex], dataLen);
             }
+            
+            buffer_release();
+            
+            // Replay macro requested by the command (See ++macro command)
+            if (_macroRunSlot != MACRO_NONE)
+                macro_run();
+            
+            // Output completion record (See ++ack command)
+            if (_ackEnable && ackEntry)
+                ack_report();
         }
         
         // Handle device mode processing
@@ -322,13 +528,6 @@ void main()
 }
 
 
-#int_timer2
-void clock_isr()
-{
-    _mSecTimer++;
-}
-
-
 #int_rda
 void RDA_isr()
 {
@@ -354,155 +553,397 @@ void RDA_isr()
     //    | Byte 0 | Byte 1 | Byte 2 | Byte 3 | ... | Byte N |
     //    |  CCF   |  DLEN  |   D1   |   D2   | ... |   DN   |
     //    where...
-    //    CCF = Control Command Flag (1 = Controller Command; 0 = Device Data)
+    //    CCF = Control Command Flag (1 = Controller Command; 0 = Device Data; 2 = Binary Data)
     //    DLEN = Data Length in Bytes
     //    D1..DN = Data of size DLEN bytes
-    
-    // UART Data Notes
-    // ===============
-    //  - All un-escaped LF (0x0a), CR (0x0d), ESC (0x1b), and '+' characters
-    //    are discarded.
     //
-    //  - Any UART input that starts with an un-escaped '++' character sequence
-    //    is interpreted as a controller command and not transmitted over GPIB.
+    //  - Controller command data ends with a null terminator (included in DLEN),
+    //    so commands can be parsed in place.
+    //
+    //  - Bytes written to the start of the ring buffer are also written to
+    //    the mirror following its end (See RING_MIRROR_LEN). Controller command
+    //    and binary data entries are always small enough to be read in place
+    //    from the mirror when they wrap around the end of the ring buffer.
+    //
+    //  - Received characters are added to the ring buffer by rx_parse_char()
+    //    (See gpib_rx.c).
 
 
     // Do nothing if no data is ready
     if (!kbhit())
         return;
     
-    uint8_t startIndex = _ringBufferWrite;
-    uint8_t readNum = 0;
-    uint8_t byteLen = 0;
-    bool escapeNext = false;
-    char c;
-    char c1 = '\0';
-    char c2 = '\0';
+    // Get character from UART
+    char c = getc();
     
-    for (;;)
+    uint8_t used = _rxWriteIndex - _ringBufferRead;
+    
+    // Track maximum ring buffer occupancy
+    if (used > _stats.rxBufferMax)
+        _stats.rxBufferMax = used;
+    
+    // Pause the host once the ring buffer reaches the high watermark.
+    // Pausing only helps while complete entries are waiting to be released,
+    // a long line that fills the buffer on its own is left to overflow.
+    if (_flowControl != FLOW_NONE && !_rxPaused && used >= FLOW_HIGH_WATERMARK &&
+        _ringBufferWrite != _ringBufferRead)
     {
-        // Get character from UART
-        c = getc();
-        readNum++;
+        _rxPaused = true;
         
-        // Save 1st and 2nd characters received.
-        // Note: These characters will be used later to determine if the received
-        //       string is a controller command.
-        if (readNum == 1)
-            c1 = c;
-            
-        if (readNum == 2)
-            c2 = c;
+#ifdef HOST_CTS
+        if (_flowControl == FLOW_RTS_CTS)
+            output_high(HOST_CTS);
+#endif
         
-        // If the escape flag is not set and an escape character is
-        // received, set the escape flag for the next character.
-        // Note: Checking that the escape flag is not set,
-        //       allows escaping of the escape character.
-        if (!escapeNext && c == ESC)
+        if (_flowControl == FLOW_XON_XOFF)
         {
-            escapeNext = true;
-            continue;
+            _txFlowChar = XOFF;
+            enable_interrupts(INT_TBE);
         }
+    }
+    
+    // Add character to the line being received
+    rx_parse_char(c);
+}
+
+
+#include "gpib_rx.c"  // UART receive line parser (rx_parse_char(), rx_entry_add())
+
+
+#int_tbe
+void TBE_isr()
+{
+    // This interrupt handler sends the next byte from the UART transmit
+    // ring buffer. The interrupt is disabled once the buffer is empty and
+    // is re-enabled by tx_putc() when more data is queued.
+    // A pending XON/XOFF flow control character is sent before queued output.
+    
+    
+    // Send flow control character first
+    if (_txFlowChar != 0)
+    {
+        putc(_txFlowChar);
+        _txFlowChar = 0;
+        return;
+    }
+    
+    // Disable interrupt if there is nothing left to send
+    if (_txBufferRead == _txBufferWrite)
+    {
+        disable_interrupts(INT_TBE);
+        return;
+    }
+    
+    putc(_txBuffer[_txBufferRead]);
+    _txBufferRead = (_txBufferRead + 1) & (TX_BUFFER_LEN - 1);
+}
+
+
+void tx_putc(char c)
+{
+    // This function queues a character in the UART transmit ring buffer.
+    // All UART output must go through this function (e.g. printf(tx_putc, ...))
+    // so that output is sent in order while GPIB transfers continue.
+    // If the buffer is full, this function waits for room in the buffer.
+    //
+    // Parameters:
+    //   [in] c: Character to send
+    
+    
+    uint8_t nextWrite = (_txBufferWrite + 1) & (TX_BUFFER_LEN - 1);
+    
+    // Wait for room in the buffer
+    // Note: Pointers being equal means empty, so one byte is always left free.
+    while (nextWrite == _txBufferRead)
+        restart_wdt();
+    
+    _txBuffer[_txBufferWrite] = c;
+    _txBufferWrite = nextWrite;
+    
+    // Start sending (Interrupt fires immediately if the UART is idle)
+    enable_interrupts(INT_TBE);
+}
+
+
+void tx_flush()
+{
+    // This function waits until all queued UART output has been sent.
+    
+    
+    // Wait for transmit buffer (and pending flow control character) to empty
+    while (_txBufferRead != _txBufferWrite || _txFlowChar != 0)
+        restart_wdt();
+    
+    // Wait for the last byte to be shifted out
+    while (!TRMT)
+        restart_wdt();
+}
+
+
+void flow_resume()
+{
+    // This function resumes the host after it was paused by flow control
+    // (See RDA_isr()). An XOFF that has not been sent yet is cancelled
+    // rather than replaced by XON.
+    
+    
+    disable_interrupts(INT_RDA);
+    disable_interrupts(INT_TBE);
+    
+    if (_rxPaused)
+    {
+        _rxPaused = false;
         
-        // Discard un-escaped '+' characters
-        if (!escapeNext && c == '+')
-            continue;
-        
-        // Exit loop if un-escaped termination character (CR or LF) is received
-        if (!escapeNext && (c == CR || c == LF))
-            break;
+#ifdef HOST_CTS
+        output_low(HOST_CTS);
+#endif
         
-        // Before adding the first character to the buffer below,
-        // advance the ring buffer write pointer 2 positions.
-        // Note: The 1st and 2nd bytes are used for the controller command flag
-        //       and data length size respectively.
-        if (byteLen == 0)
-            _ringBufferWrite += 2;
-        
-        // Add character to buffer (if escaped or a character other then ESC, '+', CR, LF)
-        _ringBuffer[_ringBufferWrite] = c;
-        _ringBufferWrite++;
-        byteLen++;
-        escapeNext = false;
-        
-        // If data added to the ring buffer has caused the pointers to become
-        // equal, then this means the buffer is full and will overflow if more
-        // bytes are added. We also don't allow the pointers to be equal unless
-        // the buffer is empty, so this data must be discarded and the write
-        // pointer must be reset to where it was before data was added to the
-        // ring buffer.
-        // Simply put, pointers being equal means empty not full,
-        // so we must discard the incoming data.
-        if (_ringBufferRead == _ringBufferWrite)
+        if (_flowControl == FLOW_XON_XOFF)
         {
-            byteLen = 0;
-            _ringBufferWrite = startIndex;
-            break;
-        }        
+            if (_txFlowChar == XOFF)
+                _txFlowChar = 0;
+            else
+                _txFlowChar = XON;
+        }
     }
     
-    // Consume any additional bytes (flush receive buffer)
-    while (kbhit())
-        getc();
+    // TBE_isr() disables itself again if there is nothing to send
+    enable_interrupts(INT_TBE);
+    enable_interrupts(INT_RDA);
+}
+
+
+void handle_abort()
+{
+    // This function handles an abort requested by the host (CAN received).
+    // Any GPIB transfer in progress has already been stopped, since transfer
+    // loops return an error while an abort is requested. The GPIB lines are
+    // returned to idle, lines received before the abort and any macro replay
+    // are discarded, and "aborted" is output, so the host knows all following
+    // responses belong to lines sent after the abort.
     
-    // Do nothing if no bytes were added to the buffer
-    if (byteLen == 0)
-        return;
     
-    // Set controller command flag if first two characters received were '++'
-    _ringBuffer[startIndex] = (c1 == '+' && c2 == '+') ? 0x01 : 0x00;
+    // Return GPIB data and handshake lines to idle
+    output_low(TE);
+    
+    output_float(DIO1);
+    output_float(DIO2);
+    output_float(DIO3);
+    output_float(DIO4);
+    output_float(DIO5);
+    output_float(DIO6);
+    output_float(DIO7);
+    output_float(DIO8);
+    
+    output_float(DAV);
+    output_low(NDAC);
+    output_low(NRFD);
+    
+    if (_gpibMode == MODE_CONTROLLER)
+    {
+        output_high(ATN);
+        output_high(EOI);
+    }
+    else
+    {
+        output_float(EOI);
+    }
+    
+    // Discard lines received before the abort
+    // Note: Lines already taken by the main loop are not released twice.
+    disable_interrupts(INT_RDA);
+    uint8_t flushIndex = _abortFlushIndex;
+    _abortRequest = false;
+    enable_interrupts(INT_RDA);
+    
+    if ((uint8_t)(flushIndex - _ringBufferRead) > (uint8_t)(_ringBufferNext - _ringBufferRead))
+        _ringBufferNext = flushIndex;
+    
+    buffer_release();
+    
+    _macroRunSlot = MACRO_NONE;
+    
+    // Disable serial poll mode if the abort interrupted a serial poll
+    if (_serialPollActive && _gpibMode == MODE_CONTROLLER)
+        gpib_serial_poll_end();
+    
+    // Unaddress the devices left addressed by the aborted transfer
+    // Note: Transfers cannot do this themselves while the abort is pending.
+    if (_gpibMode == MODE_CONTROLLER)
+    {
+        gpib_send_command(GPIB_CMD_UNT);
+        gpib_send_command(GPIB_CMD_UNL);
+    }
+    
+    // The state of the bus can no longer be trusted
+    gpib_bus_state_clear();
+    
+    // Optionally return all devices to idle
+    if (_abortIfc && _gpibMode == MODE_CONTROLLER)
+        gpib_send_ifc();
     
-    // Set data byte length
-    _ringBuffer[(uint8_t)(startIndex + 1)] = byteLen;
+    eot_printf("aborted");
 }
 
 
-bool buffer_get(uint8_t *buffer)
+#inline
+void ack_status(uint8_t status)
 {
-    // This function gets an item from the ring buffer and places it into
-    // the buffer given.
-    // It returns true if successful, false otherwise.
-    // Note: It is assumed that the destination buffer given is the same
-    //       size as the ring buffer. This prevents the data from filling
-    //       the destination buffer completely due to the fact that the
-    //       pointers will only allow the ring buffer to be filled to
-    //       its size minus one (e.g. pointers can never be equal if data
-    //       is in the ring buffer, so there is always at least one free byte).
-    //       This ensures that there will always be enough space to add a null
-    //       terminator on the end of the received data.
-
-
-    // Return false if buffer is empty
-    if (_ringBufferRead == _ringBufferWrite)
-        return false;
+    // This function sets the status reported in the completion record of
+    // the line being handled. Only the first error of a line is kept.
+    //
+    // Parameters:
+    //   [in] status: Status code (ACK_*)
+    
+    
+    if (_ackStatus == ACK_OK)
+        _ackStatus = status;
+}
+
+
+void ack_report()
+{
+    // This function outputs the completion record of the line that was
+    // handled: ACK character, status code (ACK_*) and number of bytes read
+    // (e.g. "<ACK>0,12"). The record always ends with LF, so it can be
+    // found without waiting for a timeout, whether or not EOT is enabled.
+    
+    
+    tx_putc(ACK);
+    printf(tx_putc, "%u,%Lu", _ackStatus, _ackCount);
+    tx_putc(LF);
+}
+
+
+void uart_set_baud(uint8_t index)
+{
+    // This function sets the UART baud rate.
+    // Note: Any pending output should be sent first (See tx_flush()).
+    //
+    // Parameters:
+    //   [in] index: Baud rate index (See _baudRate[])
+    
+    
+    BRG16 = 1;
+    BRGH = 1;
+    SPBRGH = 0;
+    SPBRG = _baudDivisor[index];
     
-    // Get byte length of data to copy in input buffer (CCF + DLEN + Data)
-    uint8_t byteLen = _ringBuffer[(uint8_t)(_ringBufferRead + 1)] + 2;
+    _baudIndex = index;
+}
+
+
+void uart_change_baud(uint8_t index)
+{
+    // This function changes the UART baud rate and waits for the host to
+    // confirm the new rate by sending "++baud ok". If the confirmation is not
+    // received within BAUD_CONFIRM_TICKS, the default baud rate is restored.
+    // Lines received before the confirmation are discarded.
+    //
+    // Parameters:
+    //   [in] index: Baud rate index (See _baudRate[])
+    
+    
+    // Send all pending output at the current rate
+    tx_flush();
+    
+    // Change rate and discard any partially received line
+    disable_interrupts(INT_RDA);
+    uart_set_baud(index);
+    _rxWriteIndex = _ringBufferWrite;
+    _rxByteLen = 0;
+    _rxCharCount = 0;
+    _rxEscapeNext = false;
+    _rxDiscard = false;
+    _rxBatch = false;
+    _rxSplitCount = 0;
+    _rxRawMatch = 0;
+    _rxRawLength = 0;
+    _rxRawMode = false;
+    enable_interrupts(INT_RDA);
     
-    // Zero destination buffer
-    // Note: This allows string read functions to work since any data
-    //       copied into the destination buffer will be null terminated.
-    memset(buffer, 0, BUFFER_LEN);
+    // Wait for confirmation
+    bool confirmed = false;
+    uint16_t startTime = get_timer0();
     
-    // Check if the data to be read will wrap around the
-    // ring buffer, and perform two copies if required.
-    if (((uint16_t)_ringBufferRead + byteLen) > BUFFER_LEN)
+    while (!confirmed && timer_elapsed(startTime) < BAUD_CONFIRM_TICKS)
     {
-        uint8_t readLen1 = BUFFER_LEN - _ringBufferRead;
-        uint8_t readLen2 = byteLen - readLen1;
+        restart_wdt();
         
-        memcpy(buffer, &_ringBuffer[_ringBufferRead], readLen1);
-        memcpy(&buffer[readLen1], _ringBuffer, readLen2);
+        uint8_t *pEntry = buffer_get();
+        if (pEntry == NULL)
+            continue;
+        
+        // Only an exact "++baud ok" (trailing whitespace allowed) confirms
+        confirmed = (pEntry[0] == CCF_COMMAND && pEntry[1] >= 8);
+        
+        if (confirmed)
+        {
+            trim_right(&pEntry[2]);
+            
+            confirmed = (pEntry[2] == 'b' && pEntry[3] == 'a' && pEntry[4] == 'u' && pEntry[5] == 'd'
+                && pEntry[6] == SP && pEntry[7] == 'o' && pEntry[8] == 'k' && pEntry[9] == '\0');
+        }
+        
+        buffer_release();
     }
-    else
+    
+    // Fall back to default rate if not confirmed
+    if (!confirmed)
     {
-        memcpy(buffer, &_ringBuffer[_ringBufferRead], byteLen);
+        uart_set_baud(BAUD_DEFAULT);
+        debug_printf("Error: Baud rate not confirmed.");
+        return;
     }
+    
+    eot_printf("%Lu", _baudRate[_baudIndex]);
+    
+    if (_saveCfgEnable)
+        eeprom_write_cfg();
+}
+
+
+uint8_t* buffer_get()
+{
+    // This function gets the next entry from the ring buffer without copying it.
+    // The entry is used in place and remains valid until buffer_release() is
+    // called. Entries are read in order, so several entries may be read
+    // before they are released together (See handle_binary_write()).
+    //
+    // Return Value: Pointer to the entry (CCF + DLEN + Data); NULL if buffer is empty
+    //
+    // Note: Controller command and binary data entries are always contiguous
+    //       due to the ring buffer mirror (See RING_MIRROR_LEN). Device data
+    //       entries may be longer than the mirror, so their data must be
+    //       accessed using ring buffer indexes (See gpib_send_entry()).
+
 
-    // Update the read pointer
-    _ringBufferRead += byteLen;
+    // Return NULL if buffer is empty
+    if (_ringBufferNext == _ringBufferWrite)
+        return NULL;
     
-    return true;
+    uint8_t *pEntry = &_ringBuffer[_ringBufferNext];
+    
+    // Advance to the next entry (CCF + DLEN + Data)
+    _ringBufferNext += pEntry[1] + 2;
+    
+    return pEntry;
+}
+
+
+void buffer_release()
+{
+    // This function releases all ring buffer entries returned by buffer_get()
+    // so that their space can be reused by RDA_isr().
+    
+    
+    _ringBufferRead = _ringBufferNext;
+    
+    // Resume the host once the ring buffer drains to the low watermark or
+    // only a partial line remains (RDA_isr() does not pause again for it)
+    if (_rxPaused && ((uint8_t)(_rxWriteIndex - _ringBufferRead) <= FLOW_LOW_WATERMARK ||
+        _ringBufferWrite == _ringBufferRead))
+        flow_resume();
 }
 
 
@@ -511,18 +952,15 @@ char* trim_right(char *str)
     // This function trims whitespace from the right side of the given string.
     // Note: The given string is modified in place.
     
-    uint8_t len, i;
-    
-    len = strlen(str);
-    if (len < 1)
-        return str;
+    uint8_t len = strlen(str);
     
     // Trim trailing spaces and tabs
-    i = strlen(str) - 1;
-    while (i >= 0 && (str[i] == SP || str[i] == TAB))
+    // Note: The length stops at 0 for a string of only whitespace, so
+    //       nothing outside the string is read or cleared.
+    while (len > 0 && (str[len - 1] == SP || str[len - 1] == TAB))
     {
-        str[i] = '\0';
-        i--;
+        len--;
+        str[len] = '\0';
     }
     
     return str;
@@ -628,16 +1066,23 @@ char* get_address(char *buffer, uint8_t *pad, uint8_t *sad, uint8_t *validSad)
 }
 
 
+#include "gpib_cmd.c"  // Controller command lookup (command_table_init(), command_lookup())
+
+
 void handle_command(uint8_t *buffer)
 {
     // This function handles a controller command sequence (++ command).
+    // The command name is looked up in the command table, the arguments
+    // are parsed as declared by the table entry, and the command is
+    // handled by ID.
     //
     // Parameters:
-    //   [in] buffer: Byte buffer containing a command sequence
+    //   [in] buffer: Byte buffer containing a null terminated command sequence
+    //                (CCF + DLEN + Command)
     
     
-    // Verify that the CCF flag is set and data length > 0
-    if (!buffer[0] || buffer[1] < 1)
+    // Verify that the CCF flag is set and data length > 0 (excluding null terminator)
+    if (buffer[0] != CCF_COMMAND || buffer[1] < 2)
         return;
     
     // Get a pointer to the data section of the buffer
@@ -647,371 +1092,1468 @@ void handle_command(uint8_t *buffer)
     eot_printf("Trimmed Command String: '%s'", pBuf);
 #endif
     
-    // ++addr [<PAD> [<SAD>]]    
-    if (!strncmp(pBuf, _cmdAddr, 4))
-    {        
-        if (*(pBuf+4) == '\0')  // Query current address
-        {
-            if (_useDeviceSad)
-                eot_printf("%u %u", _devicePad, _deviceSad + 0x60);
-            else
-                eot_printf("%u", _devicePad);
-        }
-        else if (*(pBuf+4) == SP)  // Set address
-        {
-            uint8_t pad, sad, validSad;
-            get_address(pBuf+5, &pad, &sad, &validSad);
-            
-            // If PAD was found valid, update address variables
-            if (pad > 0)
-            {
-                _devicePad = pad;
-                _deviceSad = sad;
-                _useDeviceSad = validSad;
-                
-                if (_saveCfgEnable)
-                    eeprom_write_cfg();
-            }
-        }
-    }
+    // Split command name and arguments
+    // Note: pArgs is NULL if no arguments were given.
+    char *pArgs = strchr(pBuf, SP);
     
-    // ++auto [0|1]
-    else if (_gpibMode == MODE_CONTROLLER && !strncmp(pBuf, _cmdAuto, 4))
+    if (pArgs != NULL)
     {
-        if (*(pBuf+4) == '\0')     // Query current auto read mode
-        {
-            eot_printf("%u", _autoRead);
-        }
-        else if (*(pBuf+4) == SP)  // Set auto read mode
-        {
-            _autoRead = atoi(pBuf+5) > 0;
-            
-            if (_saveCfgEnable)
-                eeprom_write_cfg();
-        }
+        *pArgs = '\0';
+        pArgs++;
+        
+        while (*pArgs == SP)
+            pArgs++;
     }
     
-    // ++clr
-    else if (_gpibMode == MODE_CONTROLLER && !strncmp(pBuf, _cmdClr, 3))
+    // Find command
+    uint8_t index = command_lookup(pBuf);
+    
+    if (index == CMD_NONE)
     {
-        bool errorStatus = false;
-        errorStatus = errorStatus || gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
-        errorStatus = errorStatus || gpib_send_command(GPIB_CMD_SDC);
+        ack_status(ACK_ERROR);
+        debug_printf("Unrecognized command.");
+        return;
     }
     
-    // ++eoi [0|1]
-    else if (!strncmp(pBuf, _cmdEoi, 3))
+    // Record the command instead of running it while a macro is being recorded
+    // Note: Macro commands are never recorded.
+    if (_macroRecordSlot != MACRO_NONE && _commandTable[index].id != CMD_MACRO)
     {
-        if (*(pBuf+3) == '\0')     // Query current EOI mode
-        {
-            eot_printf("%u", _useEoi);
-        }
-        else if (*(pBuf+3) == SP)  // Set EOI mode
+        if (_commandTable[index].id == CMD_BWRITE)
         {
-            _useEoi = atoi(pBuf+4) > 0;
-            
-            if (_saveCfgEnable)
-                eeprom_write_cfg();
+            ack_status(ACK_ERROR);
+            debug_printf("Error: Binary write cannot be recorded.");
         }
+        else
+            macro_record_command(pBuf, pArgs);
+        return;
+    }
+    
+    // Verify command is allowed in the current mode
+    if (!(_commandTable[index].modes & (1 << _gpibMode)))
+    {
+        ack_status(ACK_ERROR);
+        debug_printf("Unrecognized command.");
+        return;
     }
     
-    // ++eos [0|1|2|3]
-    else if (!strncmp(pBuf, _cmdEos, 3))
+    uint8_t argType = _commandTable[index].argType;
+    
+    if ((argType & ARG_REQUIRED) && pArgs == NULL)
     {
-        if (*(pBuf+3) == '\0')     // Query current EOS mode
+        ack_status(ACK_ERROR);
+        debug_printf("Missing argument.");
+        return;
+    }
+    
+    // Parse arguments
+    uint32_t value = 0;
+    uint8_t pad = 0, sad = 0, validSad = 0;
+    
+    if (pArgs != NULL)
+    {
+        switch (argType & ~ARG_REQUIRED)
+        {
+            case ARG_VALUE:
+                value = atoi32(pArgs);
+                break;
+                
+            case ARG_ADDRESS:
+                get_address(pArgs, &pad, &sad, &validSad);
+                
+                if (pad == 0)
+                    ack_status(ACK_BAD_ADDRESS);
+                break;
+        }
+    }
+    
+    switch (_commandTable[index].id)
+    {
+        // ++ack [0|1]
+        case CMD_ACK:
+            if (pArgs == NULL)  // Query current completion record mode
+            {
+                eot_printf("%u", _ackEnable);
+            }
+            else  // Set completion record mode
+            {
+                _ackEnable = value > 0;
+            }
+            break;
+            
+        // ++addr [<PAD> [<SAD>]]
+        case CMD_ADDR:
+            if (pArgs == NULL)  // Query current address
+            {
+                if (_useDeviceSad)
+                    eot_printf("%u %u", _devicePad, _deviceSad + 0x60);
+                else
+                    eot_printf("%u", _devicePad);
+            }
+            else if (pad > 0)  // Set address (If PAD was found valid)
+            {
+                _devicePad = pad;
+                _deviceSad = sad;
+                _useDeviceSad = validSad;
+                
+                if (_saveCfgEnable)
+                    eeprom_write_cfg();
+            }
+            break;
+            
+        // ++abort_ifc [0|1]
+        case CMD_ABORT_IFC:
+            if (pArgs == NULL)  // Query current abort IFC mode
+            {
+                eot_printf("%u", _abortIfc);
+            }
+            else  // Set abort IFC mode
+            {
+                _abortIfc = value > 0;
+            }
+            break;
+            
+        // ++addr_cache [0|1]
+        case CMD_ADDR_CACHE:
+            if (pArgs == NULL)  // Query current addressing cache mode
+            {
+                eot_printf("%u", _addrCacheEnable);
+            }
+            else  // Set addressing cache mode
+            {
+                _addrCacheEnable = value > 0;
+                gpib_bus_state_clear();
+            }
+            break;
+            
+        // ++addr_saved [0]
+        case CMD_ADDR_SAVED:
+            if (pArgs == NULL)       // Query number of addressing command bytes skipped
+                eot_printf("%Lu", _addrBytesSaved);
+            else if (value == 0)     // Reset counter
+                _addrBytesSaved = 0;
+            else
+                ack_status(ACK_ERROR);
+            break;
+            
+        // ++auto [0|1]
+        case CMD_AUTO:
+            if (pArgs == NULL)  // Query current auto read mode
+            {
+                eot_printf("%u", _autoRead);
+            }
+            else  // Set auto read mode
+            {
+                _autoRead = value > 0;
+                
+                if (_saveCfgEnable)
+                    eeprom_write_cfg();
+            }
+            break;
+            
+        // ++baud [<rate>|ok]
+        case CMD_BAUD:
+            if (pArgs == NULL)  // Query current baud rate
+            {
+                eot_printf("%Lu", _baudRate[_baudIndex]);
+            }
+            else if (*pArgs >= '0' && *pArgs <= '9')  // Change baud rate
+            {
+                uint32_t rate = atoi32(pArgs);
+                uint8_t i;
+                
+                // Only accept supported rates
+                for (i = 0; i < BAUD_COUNT; i++)
+                {
+                    if (_baudRate[i] == rate)
+                        break;
+                }
+                
+                if (i < BAUD_COUNT)
+                {
+                    uart_change_baud(i);
+                }
+                else
+                {
+                    ack_status(ACK_ERROR);
+                    debug_printf("Error: Unsupported baud rate.");
+                }
+            }
+            else if (*pArgs != 'o' || *(pArgs+1) != 'k' || *(pArgs+2) != '\0')
+            {
+                ack_status(ACK_ERROR);
+                debug_printf("Error: Unsupported baud rate.");
+            }
+            
+            // Note: A confirmation (++baud ok) is only expected by
+            //       uart_change_baud(), otherwise it is ignored.
+            break;
+            
+        // ++bcast [<PAD1> [<SAD1>] ... [<PAD15> [<SAD15>]]]
+        case CMD_BCAST:
+            // Send the next device data line (or binary write) to all given
+            // devices with a single addressing sequence and handshake run.
+            if (pArgs == NULL)  // Cancel broadcast
+            {
+                _bcastLength = 0;
+            }
+            else  // Arm broadcast for the next data line
+            {
+                _bcastLength = gpib_listen_list(pArgs, _bcastList);
+                
+                if (_bcastLength == 0)
+                    ack_status(ACK_BAD_ADDRESS);
+            }
+            break;
+            
+        // ++bwrite <count>
+        case CMD_BWRITE:
+        {
+            // Get byte count
+            // Note: This must be parsed the same way as in RDA_isr().
+            uint32_t length = 0;
+            
+            while (*pArgs >= '0' && *pArgs <= '9')
+            {
+                length = (length * 10) + (*pArgs - '0');
+                pArgs++;
+            }
+            
+            if (length > 0)
+                handle_binary_write(length);
+            break;
+        }
+            
+        // ++clr
+        case CMD_CLR:
+        {
+            bool errorStatus = false;
+            errorStatus = errorStatus || gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
+            errorStatus = errorStatus || gpib_send_command(GPIB_CMD_SDC);
+            break;
+        }
+            
+        // ++cmd <Byte1> [<Byte2> ... <Byte40>]
+        case CMD_CMD:
+        {
+            // Send raw GPIB command bytes (ATN asserted) in a single run,
+            // so any IEEE 488.1 message sequence can be sent with one line.
+            // Bytes are given in decimal or in hexadecimal with a 0x prefix.
+            // Nothing is sent if any byte is invalid.
+            uint8_t cmdBuffer[CMD_BYTES_MAX];
+            uint8_t length = 0;
+            bool errorStatus = false;
+            char *p = pArgs;
+            
+            while (*p != '\0')
+            {
+                uint16_t cmdByte = 0;
+                uint8_t digits = 0;
+                
+                if (length == CMD_BYTES_MAX)
+                {
+                    errorStatus = true;
+                    break;
+                }
+                
+                if (*p == '0' && (*(p+1) == 'x' || *(p+1) == 'X'))  // Hexadecimal
+                {
+                    for (p = p+2; digits <= 3; p++, digits++)
+                    {
+                        if (*p >= '0' && *p <= '9')
+                            cmdByte = (cmdByte << 4) + (*p - '0');
+                        else if (*p >= 'a' && *p <= 'f')
+                            cmdByte = (cmdByte << 4) + (*p - 'a' + 10);
+                        else if (*p >= 'A' && *p <= 'F')
+                            cmdByte = (cmdByte << 4) + (*p - 'A' + 10);
+                        else
+                            break;
+                    }
+                }
+                else  // Decimal
+                {
+                    for (; digits <= 3 && *p >= '0' && *p <= '9'; p++, digits++)
+                        cmdByte = (cmdByte * 10) + (*p - '0');
+                }
+                
+                // Byte must be 0-255 and followed by a space or the end of the line
+                if (digits == 0 || cmdByte > 0xff || (*p != SP && *p != '\0'))
+                {
+                    errorStatus = true;
+                    break;
+                }
+                
+                cmdBuffer[length++] = cmdByte;
+                
+                while (*p == SP)
+                    p++;
+            }
+            
+            if (errorStatus)
+            {
+                ack_status(ACK_ERROR);
+                debug_printf("Error: Invalid command byte.");
+                break;
+            }
+            
+            gpib_send(cmdBuffer, length, true, false);
+            
+            // Addressing may have been changed by the command bytes
+            gpib_bus_state_clear();
+            break;
+        }
+            
+        // ++debug [0|1]
+        case CMD_DEBUG:
+            if (pArgs == NULL)  // Query current debug mode
+                eot_printf("%u", _debugMode);
+            else                // Set debug mode
+                _debugMode = value > 0;
+            break;
+            
+        // ++eoi [0|1]
+        case CMD_EOI:
+            if (pArgs == NULL)  // Query current EOI mode
+            {
+                eot_printf("%u", _useEoi);
+            }
+            else  // Set EOI mode
+            {
+                _useEoi = value > 0;
+                
+                if (_saveCfgEnable)
+                    eeprom_write_cfg();
+            }
+            break;
+            
+        // ++eos [0|1|2|3]
+        case CMD_EOS:
+            if (pArgs == NULL)  // Query current EOS mode
+            {
+                eot_printf("%u", _eosMode);
+            }
+            else if (value <= 3)  // Set EOS mode (Only accept valid values)
+            {
+                _eosMode = value;
+                
+                if (_saveCfgEnable)
+                    eeprom_write_cfg();
+            }
+            else
+            {
+                ack_status(ACK_ERROR);
+            }
+            break;
+            
+        // ++eot_char [<char>]
+        case CMD_EOT_CHAR:
+            if (pArgs == NULL)  // Query current EOT character
+            {
+                eot_printf("%u", _eotChar);
+            }
+            else  // Set EOT character
+            {
+                _eotChar = value;
+                
+                if (_saveCfgEnable)
+                    eeprom_write_cfg();
+            }
+            break;
+            
+        // ++eot_enable [0|1]
+        case CMD_EOT_ENABLE:
+            if (pArgs == NULL)  // Query current EOT mode
+            {
+                eot_printf("%u", _eotEnable);
+            }
+            else  // Set EOT mode
+            {
+                _eotEnable = value > 0;
+                
+                if (_saveCfgEnable)
+                    eeprom_write_cfg();
+            }
+            break;
+            
+        // ++findlstn [sad]
+        case CMD_FINDLSTN:
+        {
+            // Address each primary address to listen and sense NDAC, then
+            // display all addresses with a listener in one response.
+            // If a primary address has no listener and the sad option is
+            // given, each secondary address of the primary address is tried.
+            // Output Format: <PAD>[,<SAD>] ...
+            // References:
+            //   IEEE 488.2-1992 - FINDLSTN Common Controller Protocol
+            bool findSad = (pArgs != NULL && *pArgs == 's' && *(pArgs+1) == 'a' && *(pArgs+2) == 'd');
+            bool errorStatus = false;
+            bool firstEntry = true;
+            
+            // Address the controller to talk, so no device can send data
+            // while NDAC is sensed (See gpib_sense_listener())
+            gpib_bus_state_clear();
+            errorStatus = gpib_send_command(CONTROLLER_ADDR + 0x40);
+            
+            for (pad = 1; pad <= 30 && !errorStatus; pad++)
+            {
+                restart_wdt();
+                
+                errorStatus = errorStatus || gpib_send_command(GPIB_CMD_UNL);
+                errorStatus = errorStatus || gpib_send_command(pad + 0x20);
+                
+                if (errorStatus)
+                    break;
+                
+                if (gpib_sense_listener())
+                {
+                    if (!firstEntry)
+                        tx_putc(SP);
+                    firstEntry = false;
+                    
+                    printf(tx_putc, "%u", pad);
+                    continue;
+                }
+                
+                if (!findSad)
+                    continue;
+                
+                for (sad = 0; sad <= 30; sad++)
+                {
+                    restart_wdt();
+                    
+                    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_UNL);
+                    errorStatus = errorStatus || gpib_send_command(pad + 0x20);
+                    errorStatus = errorStatus || gpib_send_command(sad + 0x60);
+                    
+                    if (errorStatus)
+                        break;
+                    
+                    if (gpib_sense_listener())
+                    {
+                        if (!firstEntry)
+                            tx_putc(SP);
+                        firstEntry = false;
+                        
+                        printf(tx_putc, "%u,%u", pad, sad + 0x60);
+                    }
+                }
+            }
+            
+            // Unaddress all listeners
+            if (!errorStatus)
+                gpib_send_command(GPIB_CMD_UNL);
+            
+            gpib_bus_state_clear();
+            
+            if (_eotEnable)
+                tx_putc(_eotChar);
+            break;
+        }
+            
+        // ++flow [0|1|2]
+        case CMD_FLOW:
+            if (pArgs == NULL)  // Query current flow control mode
+            {
+                eot_printf("%u", _flowControl);
+            }
+#ifdef HOST_CTS
+            else if (value <= FLOW_RTS_CTS)  // Set flow control mode (Only accept valid values)
+#else
+            else if (value <= FLOW_XON_XOFF)  // Set flow control mode (RTS/CTS requires HOST_CTS pin)
+#endif
+            {
+                // Resume the host before changing modes
+                flow_resume();
+                _flowControl = value;
+                
+                if (_saveCfgEnable)
+                    eeprom_write_cfg();
+            }
+            else
+            {
+                ack_status(ACK_ERROR);
+                debug_printf("Error: Unsupported flow control mode.");
+            }
+            break;
+            
+        // ++help
+        case CMD_HELP:
+            eot_printf("Documentation: https://github.com/steve1515/gpibusb-firmware");
+            break;
+            
+        // ++hist [0|1|reset]
+        case CMD_HIST:
+            if (pArgs == NULL)  // Query histograms
+            {
+                // Output Format: <PAD>:<NRFD High Bins>/<NDAC High Bins>/<DAV Low Bins>/<DAV High Bins> ...
+                // where bins are comma separated counts (See HIST_BINS).
+                bool firstEntry = true;
+                
+                for (uint8_t slot = 0; slot < HIST_SLOTS; slot++)
+                {
+                    if (_histSlotPad[slot] == HIST_NO_PAD)
+                        continue;
+                    
+                    if (!firstEntry)
+                        tx_putc(SP);
+                    firstEntry = false;
+                    
+                    printf(tx_putc, "%u:", _histSlotPad[slot]);
+                    
+                    for (uint8_t phase = 0; phase < HIST_PHASES; phase++)
+                    {
+                        if (phase > 0)
+                            tx_putc('/');
+                        
+                        for (uint8_t bin = 0; bin < HIST_BINS; bin++)
+                        {
+                            if (bin > 0)
+                                tx_putc(',');
+                            printf(tx_putc, "%lu", _hist[slot][phase][bin]);
+                        }
+                    }
+                }
+                
+                if (_eotEnable)
+                    tx_putc(_eotChar);
+            }
+            else if (*pArgs == 'r' && *(pArgs+1) == 'e' && *(pArgs+2) == 's'
+                && *(pArgs+3) == 'e' && *(pArgs+4) == 't')  // Reset histograms
+            {
+                hist_reset();
+            }
+            else if (*pArgs >= '0' && *pArgs <= '9')  // Enable or disable histograms
+            {
+                _histEnable = atoi(pArgs) > 0;
+            }
+            else
+            {
+                ack_status(ACK_ERROR);
+            }
+            break;
+            
+        // ++ifc
+        case CMD_IFC:
+            gpib_send_ifc();
+            break;
+            
+        // ++llo
+        case CMD_LLO:
+        {
+            bool errorStatus = false;
+            errorStatus = errorStatus || gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
+            errorStatus = errorStatus || gpib_send_command(GPIB_CMD_LLO);
+            break;
+        }
+            
+        // ++loc
+        case CMD_LOC:
+        {
+            bool errorStatus = false;
+            errorStatus = errorStatus || gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
+            errorStatus = errorStatus || gpib_send_command(GPIB_CMD_GTL);
+            break;
+        }
+            
+        // ++lon [0|1]
+        case CMD_LON:
+            if (pArgs == NULL)  // Query current listen only mode
+                eot_printf("%u", _listenOnlyMode);
+            else                // Set listen only mode
+                _listenOnlyMode = value > 0;
+            break;
+            
+        // ++macro [rec <slot>|end|run <slot> [<count>]]
+        case CMD_MACRO:
+            if (pArgs == NULL)  // Query number of bytes used in each slot
+            {
+                for (uint8_t slot = 0; slot < MACRO_SLOT_COUNT; slot++)
+                {
+                    uint8_t used = read_eeprom(MACRO_EEPROM_START + (slot * MACRO_SLOT_LEN));
+                    
+                    if (used >= MACRO_SLOT_LEN)  // Slot was never recorded
+                        used = 0;
+                    
+                    if (slot > 0)
+                        tx_putc(SP);
+                    printf(tx_putc, "%u:%u", slot, used);
+                }
+                
+                if (_eotEnable)
+                    tx_putc(_eotChar);
+            }
+            else if (*pArgs == 'e' && *(pArgs+1) == 'n' && *(pArgs+2) == 'd')  // End recording
+            {
+                macro_record_end();
+            }
+            else if (*pArgs == 'r' && *(pArgs+1) == 'e' && *(pArgs+2) == 'c' && *(pArgs+3) == SP)  // Start recording
+            {
+                // Slot number must be a single digit (Anything else is an invalid slot)
+                char *pSlot = pArgs+4;
+                uint8_t slot = MACRO_NONE;
+                
+                while (*pSlot == SP)
+                    pSlot++;
+                
+                if (*pSlot >= '0' && *pSlot <= '9' && *(pSlot+1) == '\0')
+                    slot = *pSlot - '0';
+                
+                macro_record_begin(slot);
+            }
+            else if (*pArgs == 'r' && *(pArgs+1) == 'u' && *(pArgs+2) == 'n' && *(pArgs+3) == SP)  // Replay
+            {
+                // Slot number must be a single digit, optionally followed by a repeat count
+                char *pSlot = pArgs+4;
+                uint8_t slot = MACRO_NONE;
+                
+                while (*pSlot == SP)
+                    pSlot++;
+                
+                if (*pSlot >= '0' && *pSlot <= '9' && (*(pSlot+1) == '\0' || *(pSlot+1) == SP))
+                    slot = *pSlot - '0';
+                
+                // Get optional repeat count following the slot number
+                _macroRunCount = 1;
+                pArgs = strchr(pSlot, SP);
+                if (pArgs != NULL)
+                {
+                    while (*pArgs == SP)
+                        pArgs++;
+                    
+                    if (*pArgs >= '0' && *pArgs <= '9')
+                        _macroRunCount = atoi32(pArgs);
+                    else
+                        slot = MACRO_NONE;
+                }
+                
+                if (_macroRecordSlot != MACRO_NONE || slot >= MACRO_SLOT_COUNT)
+                {
+                    ack_status(ACK_ERROR);
+                    debug_printf("Error: Macro not replayed.");
+                    break;
+                }
+                
+                // Note: The macro is replayed by the main loop once this
+                //       command is complete (Commands cannot call handle_command()).
+                _macroRunSlot = slot;
+            }
+            else
+            {
+                ack_status(ACK_ERROR);
+            }
+            break;
+            
+        // ++mode [0|1]
+        case CMD_MODE:
+            if (pArgs == NULL)  // Query current mode
+            {
+                eot_printf("%u", _gpibMode);
+            }
+            else if (_gpibMode != value && value <= 1)  // Set new mode only if mode is changed and in valid range
+            {
+                _gpibMode = value;
+                gpib_init_pins(_gpibMode);
+                gpib_bus_state_clear();
+                _listenOnlyMode = false;
+                _deviceTalk = false;
+                _deviceListen = false;
+                _deviceSerialPoll = false;
+                _deviceStatusByte = 0x00;
+                
+                if (_gpibMode == MODE_CONTROLLER)
+                    gpib_send_ifc();
+                    
+                if (_saveCfgEnable)
+                    eeprom_write_cfg();
+            }
+            else if (value > 1)
+            {
+                ack_status(ACK_ERROR);
+            }
+            break;
+            
+        // ++overflow [0]
+        case CMD_OVERFLOW:
+            if (pArgs == NULL)  // Query number of lines discarded due to a full receive buffer
+            {
+                // Note: Counter is updated from the RDA interrupt, so the
+                //       interrupt is disabled while reading the 16-bit value.
+                disable_interrupts(INT_RDA);
+                uint16_t count = _rxOverflowCount;
+                enable_interrupts(INT_RDA);
+                
+                eot_printf("%lu", count);
+            }
+            else if (value == 0)  // Reset counter
+            {
+                disable_interrupts(INT_RDA);
+                _rxOverflowCount = 0;
+                enable_interrupts(INT_RDA);
+            }
+            else
+            {
+                ack_status(ACK_ERROR);
+            }
+            break;
+            
+        // ++ppc <PAD> [<SAD>] <line> <sense>
+        case CMD_PPC:
         {
-            eot_printf("%u", _eosMode);
+            // Configure a device to respond to parallel polls on the given
+            // data line (1-8) with the given sense (0|1).
+            // Reference: IEEE 488.1-1987 - 2.9 Parallel Poll (PP) Interface Function
+            pArgs = get_address(pArgs, &pad, &sad, &validSad);
+            
+            if (pad > 0 && pArgs != NULL)
+            {
+                uint8_t line = atoi(pArgs);
+                uint8_t sense = 0xff;
+                
+                // Get sense value following the line number
+                pArgs = strchr(pArgs, SP);
+                if (pArgs != NULL)
+                    sense = atoi(pArgs+1);
+                
+                // Only accept valid values
+                if (line >= 1 && line <= 8 && sense <= 1)
+                {
+                    bool errorStatus = false;
+                    errorStatus = errorStatus || gpib_send_setup(pad, sad, validSad);
+                    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_PPC);
+                    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_PPE | (sense << 3) | (line - 1));
+                }
+                else
+                {
+                    ack_status(ACK_ERROR);
+                }
+            }
+            else
+            {
+                ack_status((pad > 0) ? ACK_ERROR : ACK_BAD_ADDRESS);
+            }
+            break;
         }
-        else if (*(pBuf+3) == SP)  // Set EOS mode
+            
+        // ++ppd <PAD> [<SAD>]
+        case CMD_PPD:
+            if (pad > 0)
+            {
+                bool errorStatus = false;
+                errorStatus = errorStatus || gpib_send_setup(pad, sad, validSad);
+                errorStatus = errorStatus || gpib_send_command(GPIB_CMD_PPC);
+                errorStatus = errorStatus || gpib_send_command(GPIB_CMD_PPD);
+            }
+            break;
+            
+        // ++ppoll
+        case CMD_PPOLL:
+        {
+            uint8_t response;
+            if (!gpib_parallel_poll(&response))
+                eot_printf("%u", response);
+            break;
+        }
+            
+        // ++ppu
+        case CMD_PPU:
+            gpib_send_command(GPIB_CMD_PPU);
+            break;
+            
+        // ++read [eoi|blk|<char>]
+        case CMD_READ:
+            if (gpib_receive_setup(_devicePad, _deviceSad, _useDeviceSad))
+                break;
+            
+            if (pArgs == NULL)                                                 // Read until timeout
+                gpib_receive_data(READ_TO_TIMEOUT, NULL);
+            else if (*pArgs == 'e' && *(pArgs+1) == 'o' && *(pArgs+2) == 'i')  // Read until EOI (or timeout)
+                gpib_receive_data(READ_TO_EOI, NULL);
+            else if (*pArgs == 'b' && *(pArgs+1) == 'l' && *(pArgs+2) == 'k')  // Read definite length block (or timeout)
+                gpib_receive_data(READ_TO_BLOCK, NULL);
+            else                                                               // Read until character (or timeout)
+                gpib_receive_data(READ_TO_CHAR, atoi(pArgs));
+            break;
+            
+        // ++read_tmo_ms <time>
+        case CMD_READ_TMO_MS:
+            if (pArgs == NULL)  // Query current timeout
+            {
+                eot_printf("%lu", _gpibTimeout);
+            }
+            else if (value <= 3000)  // Set timeout (Only accept valid values)
+            {
+                _gpibTimeout = (uint16_t)value;
+                _gpibTimeoutTicks = _gpibTimeout * TIMER_TICKS_PER_MS;
+                
+                if (_saveCfgEnable)
+                    eeprom_write_cfg();
+            }
+            else
+            {
+                ack_status(ACK_ERROR);
+            }
+            break;
+            
+        // ++rst
+        case CMD_RST:
+            tx_flush();
+            delay_ms(1);
+            reset_cpu();
+            break;
+            
+        // ++savecfg [0|1]
+        case CMD_SAVECFG:
+            if (pArgs == NULL)  // Query current save configuration mode
+            {
+                eot_printf("%u", _saveCfgEnable);
+            }
+            else  // Set save configuration mode
+            {
+                _saveCfgEnable = value > 0;
+                
+                // Save immediately when "++savecfg 1" is received
+                if (_saveCfgEnable)
+                    eeprom_write_cfg();
+            }
+            break;
+            
+        // ++spoll [<PAD> [<SAD>]]
+        case CMD_SPOLL:
+        {
+            uint8_t statusByte = 0x00;
+            
+            if (pArgs == NULL)  // Serial poll currently addressed device
+            {
+                if (!gpib_read_status_byte(&statusByte, _devicePad, _deviceSad, _useDeviceSad))
+                    tx_putc(statusByte);
+            }
+            else if (pad > 0)  // Serial poll specified device address
+            {
+                if (!gpib_read_status_byte(&statusByte, pad, sad, validSad))
+                    tx_putc(statusByte);
+            }
+            break;
+        }
+            
+        // ++spsweep [rqs] all|<PAD1> [<SAD1>] ... [<PAD15> [<SAD15>]]
+        case CMD_SPSWEEP:
+        {
+            // Serial poll each device inside a single SPE/SPD bracket and
+            // display all status bytes in one response.
+            // Output Format: <PAD>[,<SAD>]:<Status Byte> ... (Devices that do not respond are omitted)
+            // References:
+            //   IEEE 488.2-1992 - 16.2.19 SERIAL POLL
+            //   IEEE 488.2-1992 - 17.1 FINDRQS
+            bool stopOnRqs = false;
+            bool pollAll = false;
+            uint8_t statusByte;
+            bool firstEntry = true;
+            
+            // Check for stop at first device requesting service option
+            if (*pArgs == 'r' && *(pArgs+1) == 'q' && *(pArgs+2) == 's')
+            {
+                stopOnRqs = true;
+                pArgs = pArgs+3;
+                while (*pArgs == SP)
+                    pArgs++;
+            }
+            
+            // Check for poll all addresses option
+            if (*pArgs == 'a' && *(pArgs+1) == 'l' && *(pArgs+2) == 'l')
+                pollAll = true;
+            
+            // Find the addresses with a device before serial polling, so that
+            // each absent device does not cost a read timeout.
+            // Note: This is done before SPE, so no device is left addressed
+            //       to talk in serial poll state while NDAC is sensed
+            //       (See gpib_sense_listener()).
+            uint32_t presentMask = 0;
+            
+            if (pollAll)
+            {
+                gpib_bus_state_clear();
+                
+                if (!gpib_send_command(CONTROLLER_ADDR + 0x40))
+                {
+                    for (pad = 1; pad <= 30 && !_abortRequest; pad++)
+                    {
+                        restart_wdt();
+                        
+                        if (gpib_send_command(GPIB_CMD_UNL) || gpib_send_command(pad + 0x20))
+                            break;
+                        
+                        if (gpib_sense_listener())
+                            presentMask |= ((uint32_t)1 << pad);
+                    }
+                    
+                    gpib_send_command(GPIB_CMD_UNL);
+                }
+            }
+            
+            if (!gpib_serial_poll_begin())
+            {
+                for (uint8_t i = 0; i < (pollAll ? 30 : LISTEN_LIST_MAX) && !_abortRequest; i++)
+                {
+                    restart_wdt();
+                    
+                    if (pollAll)
+                    {
+                        pad = i + 1;
+                        sad = 0;
+                        validSad = 0;
+                        
+                        // Skip addresses without a device
+                        if (!(presentMask & ((uint32_t)1 << pad)))
+                            continue;
+                    }
+                    else
+                    {
+                        pArgs = get_address(pArgs, &pad, &sad, &validSad);
+                        
+                        // Exit loop if invalid PAD was found
+                        if (pad < 1)
+                        {
+                            ack_status(ACK_BAD_ADDRESS);
+                            break;
+                        }
+                    }
+                    
+                    // Display status byte if device responded
+                    if (!gpib_serial_poll_device(&statusByte, pad, sad, validSad))
+                    {
+                        if (!firstEntry)
+                            tx_putc(SP);
+                        firstEntry = false;
+                        
+                        if (validSad)
+                            printf(tx_putc, "%u,%u:%u", pad, sad + 0x60, statusByte);
+                        else
+                            printf(tx_putc, "%u:%u", pad, statusByte);
+                        
+                        // Stop at first device requesting service (RQS bit 6 set)
+                        if (stopOnRqs && (statusByte & 0x40))
+                            break;
+                    }
+                    
+                    // Exit loop if no more addresses were given
+                    if (!pollAll && pArgs == NULL)
+                        break;
+                }
+            }
+            
+            // Always disable serial poll mode (Also if enabling it failed)
+            gpib_serial_poll_end();
+            
+            if (_eotEnable)
+                tx_putc(_eotChar);
+            break;
+        }
+            
+        // ++srq
+        case CMD_SRQ:
+            eot_printf("%u", !input(SRQ));
+            break;
+            
+        // ++stats [reset]
+        case CMD_STATS:
+            if (pArgs == NULL)  // Query statistics
+            {
+                // Note: Some counters are updated from the RDA interrupt,
+                //       so a copy is made with the interrupt disabled.
+                disable_interrupts(INT_RDA);
+                Statistics stats = _stats;
+                uint16_t overflowCount = _rxOverflowCount;
+                enable_interrupts(INT_RDA);
+                
+                eot_printf("tx=%Lu rx=%Lu cmd=%Lu skip=%Lu lines=%Lu drop=%lu nrfd=%lu ndac=%lu dav=%lu eeprom=%lu rxmax=%u",
+                    stats.gpibBytesSent, stats.gpibBytesReceived, stats.gpibCommandBytes, _addrBytesSaved,
+                    stats.linesReceived, overflowCount, stats.nrfdTimeouts, stats.ndacTimeouts,
+                    stats.davTimeouts, stats.eepromWrites, stats.rxBufferMax);
+            }
+            else if (*pArgs == 'r' && *(pArgs+1) == 'e' && *(pArgs+2) == 's'
+                && *(pArgs+3) == 'e' && *(pArgs+4) == 't')  // Reset all counters
+            {
+                disable_interrupts(INT_RDA);
+                memset(&_stats, 0, sizeof(Statistics));
+                _rxOverflowCount = 0;
+                enable_interrupts(INT_RDA);
+                
+                _addrBytesSaved = 0;
+            }
+            else
+            {
+                ack_status(ACK_ERROR);
+            }
+            break;
+            
+        // ++status [0-255]
+        case CMD_STATUS:
+            if (pArgs == NULL)  // Query current status byte
+            {
+                eot_printf("%u", _deviceStatusByte);
+            }
+            else  // Set status byte
+            {
+                _deviceStatusByte = value;
+                
+                // When RQS (bit 6) is set, assert SRQ
+                if (_deviceStatusByte & 0x40)
+                    output_low(SRQ);
+                else
+                    output_high(SRQ);
+            }
+            break;
+            
+        // ++trg [[<PAD1> [<SAD1>]] [<PAD2> [<SAD2>]] ... [<PAD15> [<SAD15>]]]
+        case CMD_TRG:
+            if (pArgs == NULL)  // Send GPIB GET to currently addressed device
+            {
+                bool errorStatus = false;
+                errorStatus = errorStatus || gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
+                errorStatus = errorStatus || gpib_send_command(GPIB_CMD_GET);
+                gpib_bus_state_clear();
+            }
+            else  // Send GPIB GET to specified device addresses
+            {
+                // Address all devices to listen and send a single GET so that
+                // all devices are triggered by the same handshake.
+                // Command Bytes: MTA0 + UNL + (MLA + MSA) * 15 + GET
+                // Reference: IEEE 488.2-1992 - 16.2.4 TRIGGER
+                uint8_t cmdBuffer[2 + (LISTEN_LIST_MAX * 2) + 1];
+                uint8_t length = 0;
+                
+                cmdBuffer[length++] = CONTROLLER_ADDR + 0x40;
+                cmdBuffer[length++] = GPIB_CMD_UNL;
+                
+                uint8_t listLength = gpib_listen_list(pArgs, &cmdBuffer[length]);
+                
+                // Only send GET if at least one valid address was given
+                if (listLength > 0)
+                {
+                    length += listLength;
+                    cmdBuffer[length++] = GPIB_CMD_GET;
+                    
+                    gpib_send(cmdBuffer, length, true, false);
+                    gpib_bus_state_clear();
+                }
+                else
+                {
+                    ack_status(ACK_BAD_ADDRESS);
+                }
+            }
+            break;
+            
+        // ++ver
+        case CMD_VER:
+            eot_printf("GPIB-USB Version %u.%u%u",
+                VERSION_MAJOR, VERSION_MINOR_A, VERSION_MINOR_B);
+            break;
+            
+        // ++xfer <TPAD> [<TSAD>] <LPAD1> [<LSAD1>] ... [<LPAD15> [<LSAD15>]]
+        case CMD_XFER:
         {
-            uint8_t value = atoi(pBuf+4);
+            // Address one device to talk and other devices to listen, then
+            // take part in the handshake as an additional listener until EOI,
+            // so data moves directly between the devices at bus speed
+            // without being sent over USB.
+            // Command Bytes: UNL + (MLA + MSA) * 15 + MTA + MSA
+            // Output Format: <Byte Count> eoi|timeout|aborted
+            uint8_t cmdBuffer[1 + (LISTEN_LIST_MAX * 2) + 2];
+            uint8_t length = 0;
+            
+            // Get talker address
+            char *pList = get_address(pArgs, &pad, &sad, &validSad);
+            
+            cmdBuffer[length++] = GPIB_CMD_UNL;
+            
+            // Get listener addresses
+            uint8_t listLength = (pad > 0 && pList != NULL) ? gpib_listen_list(pList, &cmdBuffer[length]) : 0;
             
-            // Only accept valid values
-            if (value >= 0 && value <= 3)
+            if (listLength == 0)
             {
-                _eosMode = value;
+                ack_status(ACK_BAD_ADDRESS);
+                debug_printf("Error: Talker and listener addresses required.");
+                break;
+            }
+            
+            length += listLength;
+            cmdBuffer[length++] = pad + 0x40;
+            
+            if (validSad)
+                cmdBuffer[length++] = sad + 0x60;
+            
+            _histPad = pad;
+            gpib_bus_state_clear();
+            
+            // Accept data until EOI (or timeout)
+            uint32_t count = 0;
+            uint8_t eoiStatus = 0;
+            bool recvTimeout = gpib_send(cmdBuffer, length, true, false);
+            char c;
+            
+            if (!recvTimeout)
+            {
+                gpib_receive_start();
                 
-                if (_saveCfgEnable)
-                    eeprom_write_cfg();
+                while (eoiStatus == 0)
+                {
+                    restart_wdt();
+                    
+                    recvTimeout = gpib_receive_handshake(&c, &eoiStatus);
+                    
+                    if (recvTimeout)
+                        break;
+                    
+                    count++;
+                }
             }
-        }
-    }
-    
-    // ++eot_enable [0|1]
-    else if (!strncmp(pBuf, _cmdEotEnable, 10))
-    {
-        if (*(pBuf+10) == '\0')     // Query current EOT mode
-        {
-            eot_printf("%u", _eotEnable);
-        }
-        else if (*(pBuf+10) == SP)  // Set EOT mode
-        {
-            _eotEnable = atoi(pBuf+11) > 0;
             
-            if (_saveCfgEnable)
-                eeprom_write_cfg();
+            _ackCount += count;
+            
+            // Unaddress talker and listeners on every path
+            // Note: After an abort this is done by handle_abort().
+            cmdBuffer[0] = GPIB_CMD_UNT;
+            cmdBuffer[1] = GPIB_CMD_UNL;
+            gpib_send(cmdBuffer, 2, true, false);
+            gpib_bus_state_clear();
+            
+            if (!recvTimeout)
+                eot_printf("%Lu eoi", count);
+            else if (_abortRequest)
+                eot_printf("%Lu aborted", count);
+            else
+                eot_printf("%Lu timeout", count);
+            break;
         }
     }
+}
+
+
+void handle_data(uint8_t *buffer, uint8_t length)
+{
+    // This function handles device data received over USB (or replayed
+    // from a macro) by sending it to the GPIB bus.
+    //
+    // Parameters:
+    //   [in] buffer: Pointer to data to be sent (See gpib_send_entry())
+    //   [in] length: Number of bytes contained in buffer
     
-    // ++eot_char [<char>]
-    else if (!strncmp(pBuf, _cmdEotChar, 8))
+    
+    if (_gpibMode == MODE_CONTROLLER)
     {
-        if (*(pBuf+8) == '\0')     // Query current EOT character
+        bool errorStatus = false;
+        
+        // Send data to all devices of the broadcast list once if armed (See ++bcast)
+        // Note: Broadcast data is never followed by an automatic read.
+        if (_bcastLength > 0)
         {
-            eot_printf("%u", _eotChar);
+            errorStatus = errorStatus || gpib_send_setup_list(_bcastList, _bcastLength);
+            errorStatus = errorStatus || gpib_send_entry(buffer, length, _useEoi);
+            _bcastLength = 0;
+            return;
         }
-        else if (*(pBuf+8) == SP)  // Set EOT character
+        
+        // Address target device and send data
+        errorStatus = errorStatus || gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
+        errorStatus = errorStatus || gpib_send_entry(buffer, length, _useEoi);
+        
+        // Automatically read after sending data if auto read mode is enabled
+        if (_autoRead)
         {
-            _eotChar = atoi(pBuf+9);
-            
-            if (_saveCfgEnable)
-                eeprom_write_cfg();
+            errorStatus = errorStatus || gpib_receive_setup(_devicePad, _deviceSad, _useDeviceSad);
+            if (!errorStatus)
+                gpib_receive_data(READ_TO_EOI, NULL);
         }
     }
-    
-    // ++ifc
-    else if (_gpibMode == MODE_CONTROLLER && !strncmp(pBuf, _cmdIfc, 3))
-    {
-        gpib_send_ifc();
-    }
-    
-    // ++llo
-    else if (_gpibMode == MODE_CONTROLLER && !strncmp(pBuf, _cmdLlo, 3))
+    else  // Device mode
     {
-        bool errorStatus = false;
-        errorStatus = errorStatus || gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
-        errorStatus = errorStatus || gpib_send_command(GPIB_CMD_LLO);
+        // Sending data is only allowed when addressed to talk,
+        // serial poll mode disabled, and ATN deasserted.
+        // Reference: IEEE 488.1-1987 - Section 2.5.2 T Function State Diagrams
+        if (_deviceTalk && !_deviceSerialPoll && input(ATN))
+            gpib_send_entry(buffer, length, _useEoi);
     }
+}
+
+
+void handle_binary_write(uint32_t length)
+{
+    // This function sends the binary data following a binary write command
+    // (++bwrite <count>) to the GPIB bus as it is received over USB.
+    // EOI is asserted with the final byte if enabled. No string endings
+    // (EOS) are appended to binary data.
+    //
+    // Parameters:
+    //   [in] length: Number of binary data bytes following the command
     
-    // ++loc
-    else if (_gpibMode == MODE_CONTROLLER && !strncmp(pBuf, _cmdLoc, 3))
-    {
-        bool errorStatus = false;
-        errorStatus = errorStatus || gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
-        errorStatus = errorStatus || gpib_send_command(GPIB_CMD_GTL);
-    }
     
-    // ++lon [0|1]
-    else if (_gpibMode == MODE_DEVICE && !strncmp(pBuf, _cmdLon, 3))
-    {
-        if (*(pBuf+3) == '\0')     // Query current listen only mode
-            eot_printf("%u", _listenOnlyMode);
-        else if (*(pBuf+3) == SP)  // Set listen only mode
-            _listenOnlyMode = atoi(pBuf+4) > 0;
-    }
+    bool errorStatus = false;
+    uint32_t remaining = length;
+    uint16_t startTime = get_timer0();
     
-    // ++mode [0|1]
-    else if (!strncmp(pBuf, _cmdMode, 4))
+    if (_gpibMode == MODE_CONTROLLER)
     {
-        if (*(pBuf+4) == '\0')     // Query current mode
+        // Address all devices of the broadcast list if armed (See ++bcast),
+        // otherwise address target device
+        if (_bcastLength > 0)
         {
-            eot_printf("%u", _gpibMode);
+            errorStatus = gpib_send_setup_list(_bcastList, _bcastLength);
+            _bcastLength = 0;
         }
-        else if (*(pBuf+4) == SP)  // Set mode
+        else
         {
-            uint8_t value = atoi(pBuf+5);
-            
-            // Set new mode only if mode is changed and in valid range
-            if (_gpibMode != value && value >= 0 && value <= 1)
-            {
-                _gpibMode = value;
-                gpib_init_pins(_gpibMode);
-                _listenOnlyMode = false;
-                _deviceTalk = false;
-                _deviceListen = false;
-                _deviceSerialPoll = false;
-                _deviceStatusByte = 0x00;
-                
-                if (_gpibMode == MODE_CONTROLLER)
-                    gpib_send_ifc();
-                    
-                if (_saveCfgEnable)
-                    eeprom_write_cfg();
-            }
+            errorStatus = gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
         }
     }
-    
-    // Note: The processing of '++read_tmo_ms' must come before '++read' or
-    //       else it will never get processed.
-    
-    // ++read_tmo_ms <time>
-    else if (!strncmp(pBuf, _cmdReadTmoMs, 11))
+    else  // Device mode
     {
-        if (*(pBuf+11) == '\0')     // Query current timeout
-        {
-            eot_printf("%lu", _gpibTimeout);
-        }
-        else if (*(pBuf+11) == SP)  // Set timeout
+        // Sending data is only allowed when addressed to talk,
+        // serial poll mode disabled, and ATN deasserted.
+        errorStatus = !(_deviceTalk && !_deviceSerialPoll && input(ATN));
+        
+        // The binary data is still consumed below, but not sent
+        if (errorStatus)
         {
-            uint32_t value = atoi32(pBuf+12);
-            
-            // Only accept valid values
-            if (value >= 0 && value <= 3000)
-            {
-                _gpibTimeout = (uint16_t)value;
-                
-                if (_saveCfgEnable)
-                    eeprom_write_cfg();
-            }
+            ack_status(ACK_ERROR);
+            debug_printf("Error: Not addressed to talk.");
         }
     }
     
-    // ++read [eoi|<char>]
-    else if (_gpibMode == MODE_CONTROLLER && !strncmp(pBuf, _cmdRead, 4))
+    // Loop until all binary data is consumed
+    // Note: Binary data is always consumed (even after a GPIB error),
+    //       so that following lines are handled correctly.
+    while (remaining > 0)
     {
-        if (*(pBuf+4) == '\0')                                            // Read until timeout
-        {
-            if (!gpib_receive_setup(_devicePad, _deviceSad, _useDeviceSad))
-                gpib_receive_data(READ_TO_TIMEOUT, NULL);
-        }
-        else if (*(pBuf+4) == SP
-            && *(pBuf+5) == 'e' && *(pBuf+6) == 'o' && *(pBuf+7) == 'i')  // Read until EOI (or timeout)
+        restart_wdt();
+        
+        // Get binary mode before checking the ring buffer, since the last
+        // binary data is added in the same interrupt that ends binary mode.
+        bool rawMode = _rxRawMode;
+        
+        // Wait for binary data
+        if (_ringBufferNext == _ringBufferWrite)
         {
-            if (!gpib_receive_setup(_devicePad, _deviceSad, _useDeviceSad))
-                gpib_receive_data(READ_TO_EOI, NULL);
+            // Stop if binary data was discarded (Receive buffer full)
+            if (!rawMode)
+                break;
+                
+            // Stop if the host stops sending data
+            if (timer_elapsed(startTime) >= _gpibTimeoutTicks)
+            {
+                disable_interrupts(INT_RDA);
+                _rxRawMode = false;
+                _rxRawCount = 0;
+                _rxDiscard = false;
+                _rxWriteIndex = _ringBufferWrite;
+                _rxByteLen = 0;
+                enable_interrupts(INT_RDA);
+                break;
+            }
+            
+            continue;
         }
-        else if (*(pBuf+4) == SP)                                         // Read until character (or timeout)
-        {
-            char c = atoi(pBuf+5);
         
-            if (!gpib_receive_setup(_devicePad, _deviceSad, _useDeviceSad))
-                gpib_receive_data(READ_TO_CHAR, c);
-        }
+        // Stop if the next ring buffer entry is not binary data
+        // (Binary data was discarded)
+        if (_ringBuffer[_ringBufferNext] != CCF_BINARY)
+            break;
+        
+        uint8_t *pEntry = buffer_get();
+        
+        uint8_t dataLen = pEntry[1];
+        if (dataLen > remaining)
+            dataLen = remaining;
+            
+        remaining -= dataLen;
+        
+        // Send data (Assert EOI with final byte if enabled)
+        if (!errorStatus)
+            errorStatus = gpib_send(pEntry+2, dataLen, false, _useEoi && remaining == 0);
+        
+        // Release the entry (and the command entry before it) for more binary data
+        buffer_release();
+        
+        startTime = get_timer0();
     }
     
-    // ++rst
-    else if (!strncmp(pBuf, _cmdRst, 3))
+    if (remaining > 0)
     {
-        delay_ms(1);
-        reset_cpu();
+        ack_status(ACK_ERROR);
+        debug_printf("Error: Binary data incomplete (%Lu bytes missing).", remaining);
     }
+}
+
+
+void macro_record_begin(uint8_t slot)
+{
+    // This function starts recording a macro into the given slot.
+    // Until the recording is ended (See macro_record_end()), controller
+    // commands (except ++macro) and device data are recorded instead of
+    // being handled.
+    //
+    // Parameters:
+    //   [in] slot: Macro slot number (0 to MACRO_SLOT_COUNT - 1)
+    
     
-    // ++savecfg [0|1]
-    else if (!strncmp(pBuf, _cmdSavecfg, 7))
+    if (_macroRecordSlot != MACRO_NONE || slot >= MACRO_SLOT_COUNT)
     {
-        if (*(pBuf+7) == '\0')     // Query current save configuration mode
-        {
-            eot_printf("%u", _saveCfgEnable);
-        }
-        else if (*(pBuf+7) == SP)  // Set save configuration mode
-        {
-            _saveCfgEnable = atoi(pBuf+8) > 0;
-            
-            // Save immediately when "++savecfg 1" is received
-            if (_saveCfgEnable)
-                eeprom_write_cfg();
-        }
+        ack_status(ACK_ERROR);
+        debug_printf("Error: Macro recording not started.");
+        return;
     }
     
-    // ++spoll [<PAD> [<SAD>]]
-    else if (_gpibMode == MODE_CONTROLLER && !strncmp(pBuf, _cmdSpoll, 5))
+    _macroRecordSlot = slot;
+    _macroRecordLength = 0;
+    _macroRecordError = false;
+    
+    // Mark slot as empty until recording is complete
+    update_eeprom(MACRO_EEPROM_START + (slot * MACRO_SLOT_LEN), 0);
+}
+
+
+void macro_record_end()
+{
+    // This function ends recording of a macro and saves the used length
+    // of the slot. If the macro did not fit in the slot, the slot is left empty.
+    
+    
+    if (_macroRecordSlot == MACRO_NONE)
+        return;
+    
+    if (_macroRecordError)
+        debug_printf("Error: Macro too long (%u bytes maximum).", MACRO_SLOT_LEN - 1);
+    else
+        update_eeprom(MACRO_EEPROM_START + (_macroRecordSlot * MACRO_SLOT_LEN), _macroRecordLength);
+    
+    _macroRecordSlot = MACRO_NONE;
+}
+
+
+void macro_record_byte(uint8_t value)
+{
+    // This function adds a byte to the macro being recorded.
+    //
+    // Parameters:
+    //   [in] value: Byte to record
+    
+    
+    // Flag an error if the slot is full
+    if (_macroRecordLength >= MACRO_SLOT_LEN - 1)
     {
-        if (*(pBuf+5) == '\0')  // Serial poll currently addressed device
-        {
-            uint8_t statusByte = 0x00;
-            if (!gpib_read_status_byte(&statusByte, _devicePad, _deviceSad, _useDeviceSad))
-                putc(statusByte);
-        }
-        else if (*(pBuf+5) == SP)  // Serial poll specified device address
-        {
-            uint8_t pad, sad, validSad;
-            uint8_t statusByte = 0x00;
-            
-            get_address(pBuf+6, &pad, &sad, &validSad);
-            
-            if (pad > 0 && !gpib_read_status_byte(&statusByte, pad, sad, validSad))
-                putc(statusByte);
-        }
+        _macroRecordError = true;
+        return;
     }
     
-    // ++srq
-    else if (_gpibMode == MODE_CONTROLLER && !strncmp(pBuf, _cmdSrq, 3))
+    _macroRecordLength++;
+    update_eeprom(MACRO_EEPROM_START + (_macroRecordSlot * MACRO_SLOT_LEN) + _macroRecordLength, value);
+}
+
+
+void macro_record_data(uint8_t index, uint8_t length)
+{
+    // This function records device data from the UART receive ring buffer.
+    //
+    // Parameters:
+    //   [in] index: Ring buffer index of the first data byte
+    //   [in] length: Number of data bytes
+    
+    
+    macro_record_byte(CCF_DATA);
+    macro_record_byte(length);
+    
+    for (uint8_t i = 0; i < length; i++)
     {
-        eot_printf("%u", !input(SRQ));
+        restart_wdt();
+        macro_record_byte(_ringBuffer[(uint8_t)(index + i)]);
     }
+}
+
+
+void macro_record_command(char *name, char *args)
+{
+    // This function records a controller command.
+    //
+    // Parameters:
+    //   [in] name: Null terminated command name (without '++')
+    //   [in] args: Null terminated command arguments (NULL if none)
     
-    // ++status [0-255]
-    else if (_gpibMode == MODE_DEVICE && !strncmp(pBuf, _cmdStatus, 6))
-    {  
-        if (*(pBuf+6) == '\0')     // Query current status byte
-        {
-            eot_printf("%u", _deviceStatusByte);
-        }
-        else if (*(pBuf+6) == SP)  // Set status byte
-        {
-            _deviceStatusByte = atoi(pBuf+7);
-            
-            // When RQS (bit 6) is set, assert SRQ
-            if (_deviceStatusByte & 0x40)
-                output_low(SRQ);
-            else
-                output_high(SRQ);
-        }
+    
+    uint8_t nameLen = strlen(name);
+    uint8_t argsLen = (args != NULL) ? strlen(args) + 1 : 0;
+    
+    macro_record_byte(CCF_COMMAND);
+    macro_record_byte(nameLen + argsLen + 1);  // Include null terminator
+    
+    for (uint8_t i = 0; i < nameLen; i++)
+    {
+        restart_wdt();
+        macro_record_byte(name[i]);
     }
     
-    // ++trg [[<PAD1> [<SAD1>]] [<PAD2> [<SAD2>]] ... [<PAD15> [<SAD15>]]]
-    else if (_gpibMode == MODE_CONTROLLER && !strncmp(pBuf, _cmdTrg, 3))
+    if (args != NULL)
     {
-        if (*(pBuf+3) == '\0')  // Send GPIB GET to currently addressed device
-        {
-            bool errorStatus = false;
-            errorStatus = errorStatus || gpib_send_setup(_devicePad, _deviceSad, _useDeviceSad);
-            errorStatus = errorStatus || gpib_send_command(GPIB_CMD_GET);
-        }
-        else if (*(pBuf+3) == SP)  // Send GPIB GET to specified device addresses
-        {
-            uint8_t pad, sad, validSad;
-            bool errorStatus = false;
-            pBuf = pBuf+4;
+        macro_record_byte(SP);
         
-            // Send to a maximum of 15 device addresses
-            for (uint8_t i = 0; i < 15; i++)
-            {
-                restart_wdt();
-                
-                pBuf = get_address(pBuf, &pad, &sad, &validSad);
-                
-                // Exit loop if invalid PAD was found
-                if (pad < 1)
-                    break;
-                    
-                errorStatus = false;
-                errorStatus = errorStatus || gpib_send_setup(pad, sad, validSad);
-                errorStatus = errorStatus || gpib_send_command(GPIB_CMD_GET);    
-                
-                // Exit loop if no more addresses were given
-                if (pBuf == NULL)
-                    break;
-            }
+        for (uint8_t i = 0; i < argsLen - 1; i++)
+        {
+            restart_wdt();
+            macro_record_byte(args[i]);
         }
     }
     
-    // ++ver
-    else if (!strncmp(pBuf, _cmdVer, 3))
-    {
-        eot_printf("GPIB-USB Version %u.%u%u",
-            VERSION_MAJOR, VERSION_MINOR_A, VERSION_MINOR_B);
-    }
+    macro_record_byte('\0');
+}
+
+
+void macro_run()
+{
+    // This function replays the macro requested by the ++macro command
+    // (_macroRunSlot) the requested number of times (_macroRunCount).
+    // Each entry is handled the same way as a line received over USB,
+    // so results are returned as they are read.
     
-    // ++help
-    else if (!strncmp(pBuf, _cmdHelp, 4))
-    {
-        eot_printf("Documentation: https://github.com/steve1515/gpibusb-firmware");
-    }
     
-    // ++debug [0|1]
-    else if (!strncmp(pBuf, _cmdDebug, 5))
-    {
-        if (*(pBuf+5) == '\0')     // Query current debug mode
-            eot_printf("%u", _debugMode);
-        else if (*(pBuf+5) == SP)  // Set debug mode
-            _debugMode = atoi(pBuf+6) > 0;
-    }
+    uint8_t start = MACRO_EEPROM_START + (_macroRunSlot * MACRO_SLOT_LEN);
+    uint8_t used = read_eeprom(start);
     
-    // ++<unkonwn>
-    else
+    _macroRunSlot = MACRO_NONE;
+    
+    // Nothing to do if the slot was never recorded
+    if (used >= MACRO_SLOT_LEN)
+        return;
+    
+    for (uint32_t n = 0; n < _macroRunCount; n++)
     {
-        debug_printf("Unrecognized command.");
+        uint8_t pos = 1;
+        
+        while (pos + 2 <= used + 1)
+        {
+            restart_wdt();
+            
+            // Stop replaying if an abort was requested
+            if (_abortRequest)
+                return;
+            
+            // Get entry (CCF + DLEN + Data)
+            uint8_t length = read_eeprom(start + pos + 1);
+            
+            // Stop if the entry is not valid
+            if (pos + 2 + length > used + 1)
+                break;
+            
+            _macroBuffer[0] = read_eeprom(start + pos);
+            _macroBuffer[1] = length;
+            
+            for (uint8_t i = 0; i < length; i++)
+                _macroBuffer[i + 2] = read_eeprom(start + pos + 2 + i);
+            
+            pos += length + 2;
+            
+            if (_macroBuffer[0] == CCF_COMMAND)
+                handle_command(_macroBuffer);
+            else if (_macroBuffer[0] == CCF_DATA)
+                handle_data(&_macroBuffer[2], length);
+        }
     }
 }
 
@@ -1299,15 +2841,80 @@ void handle_listen_only_mode()
         }
     }
     
-    // If ATN is deasserted, we can resume normal operation
-    else
+    // If ATN is deasserted, we can resume normal operation
+    else
+    {
+        // Read data if data is available (DAV asserted)
+        // Note: In listen only mode, all data is read regardless of currently
+        //       addressed listeners.
+        if (!input(DAV))
+            gpib_receive_data(READ_TO_EOI, NULL);
+    }
+}
+
+
+void hist_record(uint8_t pad, uint8_t phase)
+{
+    // This function adds the handshake wait that started at the last
+    // hist_start() to the histogram of the given address and phase.
+    //
+    // Parameters:
+    //   [in] pad:   Device address (PAD) [0 = Commands and device mode]
+    //   [in] phase: Handshake phase (HIST_*)
+    
+    
+    uint16_t ticks = get_timer1() - _histStartT1;
+    uint8_t bin = 0;
+    
+    // Get log4 bin of wait time
+    // Note: Timer1 may have rolled over during long waits,
+    //       so Timer0 is used to detect them.
+    if (timer_elapsed(_histStartT0) >= HIST_LONG_TICKS)
+    {
+        bin = HIST_BINS - 1;
+    }
+    else
+    {
+        while (ticks != 0 && bin < (HIST_BINS - 1))
+        {
+            ticks >>= 2;
+            bin++;
+        }
+    }
+    
+    // Find histogram slot for address (Assign a free slot on first use)
+    uint8_t slot;
+    
+    for (slot = 0; slot < HIST_SLOTS; slot++)
     {
-        // Read data if data is available (DAV asserted)
-        // Note: In listen only mode, all data is read regardless of currently
-        //       addressed listeners.
-        if (!input(DAV))
-            gpib_receive_data(READ_TO_EOI, NULL);
+        if (_histSlotPad[slot] == pad)
+            break;
+        
+        if (_histSlotPad[slot] == HIST_NO_PAD)
+        {
+            _histSlotPad[slot] = pad;
+            break;
+        }
     }
+    
+    // Ignore address if all slots are used
+    if (slot >= HIST_SLOTS)
+        return;
+    
+    // Count wait (Saturate at maximum value)
+    if (_hist[slot][phase][bin] != 0xffff)
+        _hist[slot][phase][bin]++;
+}
+
+
+void hist_reset()
+{
+    // This function clears all handshake latency histograms and frees
+    // their address slots.
+    
+    
+    memset(_histSlotPad, HIST_NO_PAD, sizeof(_histSlotPad));
+    memset(_hist, 0, sizeof(_hist));
 }
 
 
@@ -1322,6 +2929,7 @@ void update_eeprom(int8_t address, int8_t value)
     if (read_eeprom(address) != value)
     {
         write_eeprom(address, value);
+        _stats.eepromWrites++;
         
 #ifdef VERBOSE_DEBUG
         eot_printf("EEPROM Write: Address = 0x%x, Value = %u (0x%x)", address, value, value);
@@ -1356,6 +2964,22 @@ void eeprom_read_cfg()
     _eotEnable =    read_eeprom(0x08);
     _eotChar =      read_eeprom(0x09);
     _gpibTimeout =  make16(read_eeprom(0x0b), read_eeprom(0x0a));
+    _flowControl =  read_eeprom(0x0c);
+    _baudIndex =    read_eeprom(0x0d);
+    
+    // Flow control and baud rate were added after the EEPROM version code
+    // was defined, so unprogrammed values (0xff) are replaced by defaults.
+#ifdef HOST_CTS
+    if (_flowControl > FLOW_RTS_CTS)
+#else
+    if (_flowControl > FLOW_XON_XOFF)
+#endif
+        _flowControl = FLOW_NONE;
+    
+    if (_baudIndex >= BAUD_COUNT)
+        _baudIndex = BAUD_DEFAULT;
+    
+    _gpibTimeoutTicks = _gpibTimeout * TIMER_TICKS_PER_MS;
 }
 
 
@@ -1380,6 +3004,8 @@ void eeprom_write_cfg()
     update_eeprom(0x09, _eotChar);
     update_eeprom(0x0a, make8(_gpibTimeout, 0));
     update_eeprom(0x0b, make8(_gpibTimeout, 1));
+    update_eeprom(0x0c, _flowControl);
+    update_eeprom(0x0d, _baudIndex);
 }
 
 
@@ -1478,6 +3104,25 @@ void gpib_send_ifc()
     output_low(IFC);
     delay_us(150);
     output_high(IFC);
+    
+    // All talkers and listeners are now unaddressed
+    gpib_bus_state_clear();
+}
+
+
+void gpib_bus_state_clear()
+{
+    // This function marks the bus addressing state as unknown, so that the
+    // next gpib_send_setup() or gpib_receive_setup() sends the complete
+    // addressing sequence.
+    // Note: This must be called whenever addressing is changed outside of the
+    //       setup functions or when the state of the bus cannot be trusted.
+    
+    
+    _busTalkerPad = BUS_ADDR_UNKNOWN;
+    _busTalkerSad = BUS_NO_SAD;
+    _busListenerPad = BUS_ADDR_UNKNOWN;
+    _busListenerSad = BUS_NO_SAD;
 }
 
 
@@ -1498,91 +3143,433 @@ bool gpib_read_status_byte(uint8_t *statusByte, uint8_t pad, uint8_t sad, bool u
     //   IEEE 488.2-1992 - 16.2.18 READ STATUS BYTE
     
     
-    // Initialize status byte to zero in case of error
-    *statusByte = 0x00;
+    // Initialize status byte to zero in case of error
+    *statusByte = 0x00;
+    
+    bool errorStatus = false;
+    
+    errorStatus = errorStatus || gpib_serial_poll_begin();
+    errorStatus = errorStatus || gpib_serial_poll_device(statusByte, pad, sad, useSad);
+    
+    // Always disable serial poll mode, even if the device did not respond
+    errorStatus = gpib_serial_poll_end() || errorStatus;
+    
+    return errorStatus;
+}
+
+
+bool gpib_serial_poll_begin()
+{
+    // This function addresses the controller to listen and enables serial
+    // poll mode on all devices. Any number of devices may then be polled
+    // with gpib_serial_poll_device() before calling gpib_serial_poll_end().
+    //
+    // Return Value: False = success; True = error
+    //
+    // References:
+    //   IEEE 488.2-1992 - 16.2.18 READ STATUS BYTE
+    //   IEEE 488.2-1992 - 16.2.19 SERIAL POLL
+    
+    
+    bool errorStatus = false;
+    
+    // Serial poll changes the bus addressing
+    gpib_bus_state_clear();
+    
+    // Serial poll must be disabled once this function has been called,
+    // even if it fails (See gpib_serial_poll_end() and handle_abort()).
+    _serialPollActive = true;
+    
+    // Send unlisten message (UNL)
+    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_UNL);
+    
+    // Send controller's listen address
+    errorStatus = errorStatus || gpib_send_command(CONTROLLER_ADDR + 0x20);
+    
+    // Send serial poll enable message (SPE)
+    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_SPE);
+    
+    return errorStatus;
+}
+
+
+bool gpib_serial_poll_device(uint8_t *statusByte, uint8_t pad, uint8_t sad, bool useSad)
+{
+    // This function reads the status byte from a single device while
+    // serial poll mode is enabled (See gpib_serial_poll_begin()).
+    //
+    // Parameters:
+    //   [out] statusByte: Status byte from device (if read successful)
+    //   [in]  pad:        Primary address (PAD) of device [Valid Range = 1-30]
+    //   [in]  sad:        Secondary address (SAD) of device [Valid Range = 0-30]
+    //   [in]  useSad:     Use secondary address
+    //
+    // Return Value: False = success; True = error
+    
+    
+    // Initialize status byte to zero in case of error
+    *statusByte = 0x00;
+    
+    bool errorStatus = false;
+    
+    // Count handshake waits of the status byte for the polled device
+    _histPad = pad;
+    
+    // Send device talk address
+    errorStatus = errorStatus || gpib_send_command(pad + 0x40);
+    
+    if (useSad)
+        errorStatus = errorStatus || gpib_send_command(sad + 0x60);
+    
+    uint8_t eoiStatus;
+    errorStatus = errorStatus || gpib_receive_byte(statusByte, &eoiStatus);
+    
+    return errorStatus;
+}
+
+
+bool gpib_serial_poll_end()
+{
+    // This function disables serial poll mode on all devices and untalks
+    // the last device polled.
+    //
+    // Return Value: False = success; True = error
+    
+    
+    bool errorStatus = false;
+    
+    // Send serial poll disable message (SPD)
+    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_SPD);
+    
+    // Send untalk message (UNT)
+    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_UNT);
+    
+    if (!errorStatus)
+        _serialPollActive = false;
+    
+    return errorStatus;
+}
+
+
+bool gpib_parallel_poll(uint8_t *response)
+{
+    // This function conducts a parallel poll by sending the identify (IDY)
+    // message (ATN and EOI asserted) and reading the data lines.
+    //
+    // Parameters:
+    //   [out] response: Parallel poll response byte (Bit 0 = DIO1 ... Bit 7 = DIO8)
+    //
+    // Return Value: False = success; True = error
+    //
+    // References:
+    //   IEEE 488.1-1987 - 2.9 Parallel Poll (PP) Interface Function
+    //   IEEE 488.2-1992 - 16.2.16 PARALLEL POLL
+    
+    
+    // Initialize response to zero in case of error
+    *response = 0x00;
+    
+    // Do nothing if not in controller mode
+    if (_gpibMode != MODE_CONTROLLER)
+    {
+        debug_printf("Error: Cannot conduct parallel poll while not in controller mode.");
+        return true;
+    }
+    
+    // Set all data lines to inputs with pullups enabled
+    output_float(DIO1);
+    output_float(DIO2);
+    output_float(DIO3);
+    output_float(DIO4);
+    output_float(DIO5);
+    output_float(DIO6);
+    output_float(DIO7);
+    output_float(DIO8);
+    
+    // Set DAV line to input with pullup enabled
+    output_float(DAV);
+    
+    // Disable talking on the GPIB bus
+    output_low(TE);
+    
+    // Hold off any data transfer while polling
+    output_low(NDAC);
+    output_low(NRFD);
+    
+    // Send identify message (IDY)
+    output_low(ATN);
+    output_low(EOI);
+    
+    // Wait for devices to respond (Parallel poll response time T6 = 2 uSec)
+    delay_us(2);
+    
+    // Read data lines
+    // Note: Data lines are active low.
+    *response = input_b() ^ 0xff;
+    
+    // End identify message
+    output_high(EOI);
+    output_high(ATN);
+    
+    return false;
+}
+
+
+bool gpib_send_setup(uint8_t pad, uint8_t sad, bool useSad)
+{
+    // This function configures the GPIB bus so that data can be transferred
+    // from the controller to a device.
+    //
+    // Parameters:
+    //   [in] pad:    Primary address (PAD) of device [Valid Range = 1-30]
+    //   [in] sad:    Secondary address (SAD) of device [Valid Range = 0-30]
+    //   [in] useSad: Use secondary address
+    //
+    // Return Value: False = success; True = error
+    //
+    // References:
+    //   IEEE 488.2-1992 - 16.2.2 SEND SETUP
+    
+    
+    // Verify PAD is in range of 1-30
+    if (pad < 1 || pad > 30)
+    {
+        ack_status(ACK_BAD_ADDRESS);
+        debug_printf("Error: Device address out of range (PAD = %u).", pad);
+        return true;
+    }
+        
+    // Verify SAD is in range of 0-30 if used
+    if (useSad && sad > 30)
+    {
+        ack_status(ACK_BAD_ADDRESS);
+        debug_printf("Error: Device address out of range (SAD = %u).", sad);
+        return true;
+    }
+    
+#ifdef VERBOSE_DEBUG
+    if (useSad)
+        eot_printf("GPIB Setup Send: PAD = %u, SAD = %u", pad, sad + 0x60);
+    else    
+        eot_printf("GPIB Setup Send: PAD = %u", pad);
+#endif    
+    
+    _histPad = pad;
+    
+    bool errorStatus = false;
+    uint8_t listenSad = useSad ? sad : BUS_NO_SAD;
+    
+    // Send controller's talk address (skipped if controller is already talker)
+    if (_addrCacheEnable && _busTalkerPad == CONTROLLER_ADDR)
+    {
+        _addrBytesSaved++;
+    }
+    else
+    {
+        errorStatus = errorStatus || gpib_send_command(CONTROLLER_ADDR + 0x40);
+    }
+    
+    // Address device to listen (skipped if device is already the only listener)
+    if (_addrCacheEnable && _busListenerPad == pad && _busListenerSad == listenSad)
+    {
+        _addrBytesSaved += useSad ? 3 : 2;
+    }
+    else
+    {
+        // Send unlisten message (UNL)
+        // Note: This is skipped if only the controller is listening, since
+        //       no device can be listening in that case.
+        if (_addrCacheEnable && _busListenerPad == CONTROLLER_ADDR)
+            _addrBytesSaved++;
+        else
+            errorStatus = errorStatus || gpib_send_command(GPIB_CMD_UNL);
+        
+        // Send device listen address
+        errorStatus = errorStatus || gpib_send_command(pad + 0x20);
+        
+        if (useSad)
+            errorStatus = errorStatus || gpib_send_command(sad + 0x60);
+        
+        // Stop if the device did not become a listener (e.g. powered off)
+        errorStatus = errorStatus || gpib_find_listener();
+    }
+    
+    // Update bus addressing state
+    if (errorStatus)
+    {
+        gpib_bus_state_clear();
+    }
+    else
+    {
+        _busTalkerPad = CONTROLLER_ADDR;
+        _busTalkerSad = BUS_NO_SAD;
+        _busListenerPad = pad;
+        _busListenerSad = listenSad;
+    }
+    
+    return errorStatus;
+}
+
+
+bool gpib_send_setup_list(uint8_t *listBuffer, uint8_t listLength)
+{
+    // This function configures the GPIB bus so that data can be transferred
+    // from the controller to several devices at the same time.
+    // Command Bytes: MTA0 + UNL + (MLA + MSA) * 15
+    //
+    // Parameters:
+    //   [in] listBuffer: Listen address command bytes (See gpib_listen_list())
+    //   [in] listLength: Number of bytes in listBuffer
+    //
+    // Return Value: False = success; True = error
+    
+    
+    uint8_t cmdBuffer[2 + (LISTEN_LIST_MAX * 2)];
+    
+    cmdBuffer[0] = CONTROLLER_ADDR + 0x40;
+    cmdBuffer[1] = GPIB_CMD_UNL;
+    memcpy(&cmdBuffer[2], listBuffer, listLength);
+    
+    _histPad = listBuffer[0] - 0x20;
+    
+    // Listen address lists are not tracked by the addressing cache
+    gpib_bus_state_clear();
+    
+    bool errorStatus = false;
+    errorStatus = errorStatus || gpib_send(cmdBuffer, listLength + 2, true, false);
+    errorStatus = errorStatus || gpib_find_listener();
+    
+    if (!errorStatus)
+        _busTalkerPad = CONTROLLER_ADDR;
+    
+    return errorStatus;
+}
+
+
+bool gpib_find_listener()
+{
+    // This function checks that at least one device is listening after
+    // listen addressing, by deasserting ATN and sensing NDAC. Addressed
+    // listeners keep NDAC asserted (low) until data is sent, while all other
+    // devices release NDAC once ATN is deasserted. If NDAC goes high (and
+    // stays high for LISTENER_SETTLE_TICKS) within LISTENER_SENSE_TICKS,
+    // no device accepted the listen address.
+    // Note: This function must only be called in controller mode after
+    //       listen addressing was sent (TE enabled by gpib_send()).
+    //
+    // Return Value: False = listener found; True = no listener
+    //
+    // References:
+    //   IEEE 488.2-1992 - FINDLSTN Common Controller Protocol
+    
+    
+    if (gpib_sense_listener())
+        return false;
     
-    bool errorStatus = false;
+    ack_status(ACK_NO_LISTENERS);
+    debug_printf("Error: No listener found.");
+    return true;
+}
+
+
+bool gpib_sense_listener()
+{
+    // This function deasserts ATN and senses NDAC to determine whether any
+    // device is addressed to listen (See gpib_find_listener()).
+    // Note: The controller must be the addressed talker (MTA0), so no
+    //       device sends data while ATN is deasserted. TE stays enabled,
+    //       since NDAC can only be sensed while talking is enabled.
+    //
+    // Return Value: True = listener found; False = no listener
     
-    // Send unlisten message (UNL)
-    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_UNL);
     
-    // Send controller's listen address
-    errorStatus = errorStatus || gpib_send_command(CONTROLLER_ADDR + 0x20);
+    // Release the data lines and keep DAV deasserted, so no data byte is
+    // offered to the listeners while ATN is deasserted
+    output_b(0xff);
+    output_high(DAV);
     
-    // Send serial poll enable message (SPE)
-    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_SPE);
+    // Release NDAC and NRFD, so only devices on the bus can hold them low
+    output_float(NDAC);
+    output_float(NRFD);
     
-    // Send device talk address
-    errorStatus = errorStatus || gpib_send_command(pad + 0x40);
+    // Wait for acceptors to assert NDAC again following the handshake of the
+    // last command byte, while ATN is still asserted. Otherwise a listener
+    // that has not yet asserted NDAC would be reported as absent.
+    uint16_t startTime = get_timer1();
     
-    if (useSad)
-        errorStatus = errorStatus || gpib_send_command(sad + 0x60);
+    while (input(NDAC) && (uint16_t)(get_timer1() - startTime) < LISTENER_SENSE_TICKS)
+        restart_wdt();
     
-    uint8_t eoiStatus;
-    errorStatus = errorStatus || gpib_receive_byte(statusByte, &eoiStatus);
+    // Deassert ATN
+    output_high(ATN);
     
-    // Send serial poll disable message (SPD)
-    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_SPD);
+    // No listener if NDAC goes high and stays high for LISTENER_SETTLE_TICKS
+    bool ndacHigh = false;
+    uint16_t highTime = 0;
     
-    // Send untalk message (UNT)
-    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_UNT);
+    startTime = get_timer1();
     
-    return errorStatus;
+    while ((uint16_t)(get_timer1() - startTime) < LISTENER_SENSE_TICKS)
+    {
+        if (!input(NDAC))
+        {
+            ndacHigh = false;
+        }
+        else if (!ndacHigh)
+        {
+            ndacHigh = true;
+            highTime = get_timer1();
+        }
+        else if ((uint16_t)(get_timer1() - highTime) >= LISTENER_SETTLE_TICKS)
+        {
+            return false;
+        }
+    }
+    
+    return true;
 }
 
 
-bool gpib_send_setup(uint8_t pad, uint8_t sad, bool useSad)
+uint8_t gpib_listen_list(char *buffer, uint8_t *cmdBuffer)
 {
-    // This function configures the GPIB bus so that data can be transferred
-    // from the controller to a device.
+    // This function converts a string of device addresses into the
+    // listen address command bytes (MLA and MSA) used to address
+    // multiple devices to listen at the same time.
     //
     // Parameters:
-    //   [in] pad:    Primary address (PAD) of device [Valid Range = 1-30]
-    //   [in] sad:    Secondary address (SAD) of device [Valid Range = 0-30]
-    //   [in] useSad: Use secondary address
+    //   [in]  buffer:    String of PADs or PAD/SAD combinations (See get_address())
+    //   [out] cmdBuffer: Buffer where command bytes will be returned
+    //                    (Must hold at least LISTEN_LIST_MAX * 2 bytes)
     //
-    // Return Value: False = success; True = error
+    // Return Value: Number of command bytes placed in cmdBuffer (0 = no valid address)
     //
-    // References:
-    //   IEEE 488.2-1992 - 16.2.2 SEND SETUP
+    // Note: Conversion stops at the first invalid PAD or after
+    //       LISTEN_LIST_MAX device addresses.
     
     
-    // Verify PAD is in range of 1-30
-    if (pad < 1 || pad > 30)
+    uint8_t pad, sad, validSad;
+    uint8_t length = 0;
+    char *pBuf = buffer;
+    
+    for (uint8_t i = 0; i < LISTEN_LIST_MAX; i++)
     {
-        debug_printf("Error: Device address out of range (PAD = %u).", pad);
-        return true;
-    }
+        pBuf = get_address(pBuf, &pad, &sad, &validSad);
         
-    // Verify SAD is in range of 0-30 if used
-    if (useSad && sad > 30)
-    {
-        debug_printf("Error: Device address out of range (SAD = %u).", sad);
-        return true;
+        // Exit loop if invalid PAD was found
+        if (pad < 1)
+            break;
+        
+        cmdBuffer[length++] = pad + 0x20;
+        
+        if (validSad)
+            cmdBuffer[length++] = sad + 0x60;
+        
+        // Exit loop if no more addresses were given
+        if (pBuf == NULL)
+            break;
     }
     
-#ifdef VERBOSE_DEBUG
-    if (useSad)
-        eot_printf("GPIB Setup Send: PAD = %u, SAD = %u", pad, sad + 0x60);
-    else    
-        eot_printf("GPIB Setup Send: PAD = %u", pad);
-#endif    
-    
-    bool errorStatus = false;
-    
-    // Send controller's talk address
-    errorStatus = errorStatus || gpib_send_command(CONTROLLER_ADDR + 0x40);
-    
-    // Send unlisten message (UNL)
-    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_UNL);
-    
-    // Send device listen address
-    errorStatus = errorStatus || gpib_send_command(pad + 0x20);
-    
-    if (useSad)
-        errorStatus = errorStatus || gpib_send_command(sad + 0x60);
-    
-    return errorStatus;
+    return length;
 }
 
 
@@ -1649,6 +3636,37 @@ bool gpib_send_data(uint8_t *buffer, uint8_t length, bool useEoi)
 }
 
 
+bool gpib_send_entry(uint8_t *buffer, uint8_t length, bool useEoi)
+{
+    // This function sends device data without copying it. Data in the
+    // UART receive ring buffer that wraps around the end of the ring buffer
+    // (beyond the mirror) is sent in two parts. The selected string endings
+    // are automatically sent with the data.
+    //
+    // Parameters:
+    //   [in] buffer: Pointer to data to be sent (May point into the ring buffer)
+    //   [in] length: Number of bytes contained in buffer
+    //   [in] useEoi: True = Assert EOI with last data byte
+    //
+    // Return Value: False = success; True = error
+
+
+    // Send data in one part if it is not in the ring buffer or
+    // it is contiguous (including the mirror)
+    if (buffer < _ringBuffer || buffer >= &_ringBuffer[BUFFER_LEN]
+        || (buffer + length) <= &_ringBuffer[BUFFER_LEN + RING_MIRROR_LEN])
+        return gpib_send_data(buffer, length, useEoi);
+    
+    bool errorStatus = false;
+    uint8_t length1 = &_ringBuffer[BUFFER_LEN] - buffer;
+    
+    errorStatus = errorStatus || gpib_send(buffer, length1, false, false);
+    errorStatus = errorStatus || gpib_send_data(_ringBuffer, length - length1, useEoi);
+    
+    return errorStatus;
+}
+
+
 bool gpib_send(uint8_t *buffer, uint8_t length, bool isCommand, bool useEoi)
 {
     // This function sends a GPIB command or string of bytes to a device
@@ -1675,6 +3693,7 @@ bool gpib_send(uint8_t *buffer, uint8_t length, bool isCommand, bool useEoi)
     // Do not allow commands unless in controller mode
     if (isCommand && _gpibMode != MODE_CONTROLLER)
     {
+        ack_status(ACK_ERROR);
         debug_printf("Error: Trying to send GPIB command while not in controller mode.");
         return true;
     }
@@ -1683,6 +3702,9 @@ bool gpib_send(uint8_t *buffer, uint8_t length, bool isCommand, bool useEoi)
     if (isCommand)
         useEoi = false;
     
+    uint16_t startTime;
+    uint8_t histPad = (isCommand || _gpibMode == MODE_DEVICE) ? 0 : _histPad;
+    
     // Set NDAC and NRFD lines to inputs with pullups enabled
     output_float(NDAC);
     output_float(NRFD);
@@ -1713,9 +3735,18 @@ bool gpib_send(uint8_t *buffer, uint8_t length, bool isCommand, bool useEoi)
         eot_printf("GPIB Send Byte: '%c' (0x%x)", buffer[i], buffer[i]);
 #endif
 
+        // Stop if an abort was requested (Bus is released by handle_abort())
+        if (_abortRequest)
+        {
+            ack_status(ACK_ABORTED);
+            return true;
+        }
+
         // Check for error condition where NRFD and NDAC are both high
         if (input(NRFD) && input(NDAC))
         {
+            ack_status(ACK_NO_LISTENERS);
+            gpib_bus_state_clear();
             debug_printf("Error: NRFD and NDAC lines both high.");
             return true;
         }
@@ -1725,20 +3756,31 @@ bool gpib_send(uint8_t *buffer, uint8_t length, bool isCommand, bool useEoi)
         output_b(buffer[i] ^ 0xff);
         
         // Wait for listeners to be ready for data (NRFD high)
-        _mSecTimer = 0;
-        enable_interrupts(INT_TIMER2);
-        while (!input(NRFD))
+        hist_start();
+        if (!input(NRFD))
         {
-            restart_wdt();
-            
-            if(_mSecTimer >= _gpibTimeout)
+            startTime = get_timer0();
+            while (!input(NRFD))
             {
-                disable_interrupts(INT_TIMER2);
-                debug_printf("Timeout: Waiting for NRFD to go high during send.");
-                return true;
+                restart_wdt();
+                
+                if (_abortRequest)
+                {
+                    ack_status(ACK_ABORTED);
+                    return true;
+                }
+                
+                if (timer_elapsed(startTime) >= _gpibTimeoutTicks)
+                {
+                    _stats.nrfdTimeouts++;
+                    ack_status(ACK_TIMEOUT_NRFD);
+                    gpib_bus_state_clear();
+                    debug_printf("Timeout: Waiting for NRFD to go high during send.");
+                    return true;
+                }
             }
         }
-        disable_interrupts(INT_TIMER2);
+        hist_stop(histPad, HIST_NRFD_HIGH);
         
         // Assert EOI if required and this is the last byte in the buffer
         if (useEoi && (i == (length - 1)))
@@ -1748,26 +3790,42 @@ bool gpib_send(uint8_t *buffer, uint8_t length, bool isCommand, bool useEoi)
         output_low(DAV);
         
         // Wait for listeners to indicate they have read the data (NDAC high)
-        _mSecTimer = 0;
-        enable_interrupts(INT_TIMER2);
-        while (!input(NDAC))
+        hist_start();
+        if (!input(NDAC))
         {
-            restart_wdt();
-            
-            if(_mSecTimer >= _gpibTimeout)
+            startTime = get_timer0();
+            while (!input(NDAC))
             {
-                disable_interrupts(INT_TIMER2);
-                output_high(DAV);
-                debug_printf("Timeout: Waiting for NDAC to go high during send.");
-                return true;
+                restart_wdt();
+                
+                if (_abortRequest)
+                {
+                    ack_status(ACK_ABORTED);
+                    return true;
+                }
+                
+                if (timer_elapsed(startTime) >= _gpibTimeoutTicks)
+                {
+                    _stats.ndacTimeouts++;
+                    ack_status(ACK_TIMEOUT_NDAC);
+                    output_high(DAV);
+                    gpib_bus_state_clear();
+                    debug_printf("Timeout: Waiting for NDAC to go high during send.");
+                    return true;
+                }
             }
         }
-        disable_interrupts(INT_TIMER2);
+        hist_stop(histPad, HIST_NDAC_HIGH);
 
         // Indicate data is no longer valid
         output_high(DAV);
     }
     
+    if (isCommand)
+        _stats.gpibCommandBytes += length;
+    else
+        _stats.gpibBytesSent += length;
+    
     return false;
 }
 
@@ -1791,6 +3849,7 @@ bool gpib_receive_setup(uint8_t pad, uint8_t sad, bool useSad)
     // Verify PAD is in range of 1-30
     if (pad < 1 || pad > 30)
     {
+        ack_status(ACK_BAD_ADDRESS);
         debug_printf("Error: Device address out of range (PAD = %u).", pad);
         return true;
     }
@@ -1798,6 +3857,7 @@ bool gpib_receive_setup(uint8_t pad, uint8_t sad, bool useSad)
     // Verify SAD is in range of 0-30 if used
     if (useSad && sad > 30)
     {
+        ack_status(ACK_BAD_ADDRESS);
         debug_printf("Error: Device address out of range (SAD = %u).", sad);
         return true;
     }
@@ -1809,19 +3869,50 @@ bool gpib_receive_setup(uint8_t pad, uint8_t sad, bool useSad)
         eot_printf("GPIB Setup Receive: PAD = %u", pad);
 #endif       
     
-    bool errorStatus = 0;
+    _histPad = pad;
     
-    // Send unlisten message (UNL)
-    errorStatus = errorStatus || gpib_send_command(GPIB_CMD_UNL);
+    bool errorStatus = 0;
+    uint8_t talkSad = useSad ? sad : BUS_NO_SAD;
     
-    // Send controller's listen address
-    errorStatus = errorStatus || gpib_send_command(CONTROLLER_ADDR + 0x20);
+    // Address controller to listen (skipped if controller is already the only listener)
+    if (_addrCacheEnable && _busListenerPad == CONTROLLER_ADDR)
+    {
+        _addrBytesSaved += 2;
+    }
+    else
+    {
+        // Send unlisten message (UNL)
+        errorStatus = errorStatus || gpib_send_command(GPIB_CMD_UNL);
+        
+        // Send controller's listen address
+        errorStatus = errorStatus || gpib_send_command(CONTROLLER_ADDR + 0x20);
+    }
     
-    // Send device talk address
-    errorStatus = errorStatus || gpib_send_command(pad + 0x40);
+    // Send device talk address (skipped if device is already talker)
+    if (_addrCacheEnable && _busTalkerPad == pad && _busTalkerSad == talkSad)
+    {
+        _addrBytesSaved += useSad ? 2 : 1;
+    }
+    else
+    {
+        errorStatus = errorStatus || gpib_send_command(pad + 0x40);
+        
+        if (useSad)
+            errorStatus = errorStatus || gpib_send_command(sad + 0x60);
+    }
     
-    if (useSad)
-        errorStatus = errorStatus || gpib_send_command(sad + 0x60);
+    // Update bus addressing state
+    if (errorStatus)
+    {
+        gpib_bus_state_clear();
+    }
+    else
+    {
+        _busTalkerPad = pad;
+        _busTalkerSad = talkSad;
+        _busListenerPad = CONTROLLER_ADDR;
+        _busListenerSad = BUS_NO_SAD;
+    }
     
     return errorStatus;
 }
@@ -1842,8 +3933,17 @@ bool gpib_receive_byte(char *buffer, uint8_t *eoiStatus)
     //   IEEE 488.2-1992 - 16.2.6 RECEIVE RESPONSE MESSAGE
     
     
-    // Initialize EOI status in case of error
-    *eoiStatus = 0;
+    gpib_receive_start();
+    return gpib_receive_handshake(buffer, eoiStatus);
+}
+
+
+void gpib_receive_start()
+{
+    // This function configures the GPIB lines for receiving data from a
+    // device. The lines only need to be configured once per message, after
+    // which gpib_receive_handshake() can be called for each byte.
+    
     
     // Set all data lines to inputs with pullups enabled
     output_float(DIO1);
@@ -1866,61 +3966,122 @@ bool gpib_receive_byte(char *buffer, uint8_t *eoiStatus)
     // Disable talking on the GPIB bus (enable talking)
     output_low(TE);
     
-    // Indicate that we are ready to accept data
+    // Assert NDAC and NRFD until the handshake begins
+    // Note: This also sets NDAC and NRFD to outputs, which
+    //       gpib_receive_handshake() relies on.
     output_low(NDAC);
-    output_high(NRFD);
+    output_low(NRFD);
+}
+
+
+bool gpib_receive_handshake(char *buffer, uint8_t *eoiStatus)
+{
+    // This function performs the acceptor handshake for a single byte.
+    // Note: The GPIB lines must be configured with gpib_receive_start() first.
+    //       The handshake lines are accessed directly (See gpib_usb.h), so
+    //       no pin directions are set for each byte.
+    //
+    // Parameters:
+    //   [out] buffer:    Pointer to buffer where byte will be returned
+    //   [out] eoiStatus: 1 = EOI was asserted with byte; 0 = EOI was deasserted with byte
+    //
+    // Return Value: False = success; True = timeout on receive (or abort requested)
+    //
+    // References:
+    //   IEEE 488.1-1987 - Annex B Handshake Process Timing Sequence
+    
+    
+    uint16_t startTime;
+    uint8_t histPad = (_gpibMode == MODE_DEVICE) ? 0 : _histPad;
+    
+    // Initialize EOI status in case of error
+    *eoiStatus = 0;
+    
+    // Stop if an abort was requested (Bus is released by handle_abort())
+    if (_abortRequest)
+    {
+        ack_status(ACK_ABORTED);
+        return true;
+    }
+    
+    // Indicate that we are ready to accept data
+    NRFD_OUT = 1;
     
     // Wait for data to become valid (DAV low)
-    _mSecTimer = 0;
-    enable_interrupts(INT_TIMER2);
-    while (input(DAV))
+    hist_start();
+    if (DAV_IN)
     {
-        restart_wdt();
-        
-        if(_mSecTimer >= _gpibTimeout)
+        startTime = get_timer0();
+        while (DAV_IN)
         {
-            disable_interrupts(INT_TIMER2);
-            output_low(NRFD);
-            debug_printf("Timeout: Waiting for DAV to go low during receive.");
-            return true;
+            restart_wdt();
+            
+            if (_abortRequest)
+            {
+                ack_status(ACK_ABORTED);
+                return true;
+            }
+            
+            if (timer_elapsed(startTime) >= _gpibTimeoutTicks)
+            {
+                _stats.davTimeouts++;
+                ack_status(ACK_TIMEOUT_DAV);
+                NRFD_OUT = 0;
+                gpib_bus_state_clear();
+                debug_printf("Timeout: Waiting for DAV to go low during receive.");
+                return true;
+            }
         }
     }
-    disable_interrupts(INT_TIMER2);
+    hist_stop(histPad, HIST_DAV_LOW);
 
     // Assert NRFD to indicate data is being read
-    output_low(NRFD);
+    NRFD_OUT = 0;
     
     // Read data lines and EOI
     // Note: Data lines and EOI are active low.
-    *buffer = input_b() ^ 0xff;
-    *eoiStatus = !input(EOI);
+    *buffer = PORTB ^ 0xff;
+    *eoiStatus = !EOI_IN;
 
 #ifdef VERBOSE_DEBUG
     eot_printf("GPIB Receive Byte: %c (0x%x) [EOI = %u]", *buffer, *buffer, *eoiStatus);
 #endif
 
     // Deassert NDAC to indicate data has been accepted
-    output_high(NDAC);
+    NDAC_OUT = 1;
     
     // Wait for DAV to go high
-    _mSecTimer = 0;
-    enable_interrupts(INT_TIMER2);
-    while (!input(DAV))
+    hist_start();
+    if (!DAV_IN)
     {
-        restart_wdt();
-        
-        if(_mSecTimer >= _gpibTimeout)
+        startTime = get_timer0();
+        while (!DAV_IN)
         {
-            disable_interrupts(INT_TIMER2);
-            output_low(NDAC);
-            debug_printf("Timeout: Waiting for DAV to go high during receive.");
-            return true;
+            restart_wdt();
+            
+            if (_abortRequest)
+            {
+                ack_status(ACK_ABORTED);
+                return true;
+            }
+            
+            if (timer_elapsed(startTime) >= _gpibTimeoutTicks)
+            {
+                _stats.davTimeouts++;
+                ack_status(ACK_TIMEOUT_DAV);
+                NDAC_OUT = 0;
+                gpib_bus_state_clear();
+                debug_printf("Timeout: Waiting for DAV to go high during receive.");
+                return true;
+            }
         }
     }
-    disable_interrupts(INT_TIMER2);
+    hist_stop(histPad, HIST_DAV_HIGH);
 
     // Assert NDAC
-    output_low(NDAC);
+    NDAC_OUT = 0;
+    
+    _stats.gpibBytesReceived++;
     
     return false;
 }
@@ -1931,11 +4092,23 @@ void gpib_receive_data(uint8_t readMode, char readToChar)
     // This function receives a response message from a device on the GPIB bus.
     //
     // Parameters:
-    //   [in] readMode:   Read mode to use (e.g. To Timeout, To EOI, To Character)
+    //   [in] readMode:   Read mode to use (e.g. To Timeout, To EOI, To Character, To Block)
     //   [in] readToChar: Character to read to when in read-to-character mode
     //
+    // Read To Block Mode
+    // ==================
+    // A definite length arbitrary block (#<N><Length><Data>) is read.
+    // Any bytes preceding the block, the block header and exactly <Length>
+    // data bytes are output. The message terminator following the block is
+    // read up to LF or EOI and discarded. No EOT character is output in this
+    // mode, since it could not be told apart from binary block data.
+    // If no definite length block is found (or #0 indefinite length block),
+    // data is read until EOI. A block that ends with EOI before <Length>
+    // data bytes were received is reported as an error.
+    //
     // References:
     //   IEEE 488.2-1992 - 16.2.6 RECEIVE RESPONSE MESSAGE
+    //   IEEE 488.2-1992 - 8.7.9 <DEFINITE LENGTH ARBITRARY BLOCK RESPONSE DATA>
 
 
 #ifdef VERBOSE_DEBUG
@@ -1946,34 +4119,130 @@ void gpib_receive_data(uint8_t readMode, char readToChar)
     uint8_t eoiStatus;
     bool recvTimeout;
     
+    bool blockMode = (readMode == READ_TO_BLOCK);
+    uint8_t blockState = BLOCK_PREFIX;
+    uint8_t blockDigits = 0;
+    uint32_t blockLength = 0;
+    
+    uint8_t ackStatus = _ackStatus;
+    uint32_t ackCount = _ackCount;
+    
+    // Configure GPIB lines once for the whole message
+    gpib_receive_start();
+    
     // Loop while reading data
     for (;;)
     {
         restart_wdt();
         
         // Read byte from GPIB device
-        recvTimeout = gpib_receive_byte(&c, &eoiStatus);
+        recvTimeout = gpib_receive_handshake(&c, &eoiStatus);
         
         // Stop reading on timeout
         if (recvTimeout)
             break;
+        
+        // Track definite length block in read to block mode
+        if (readMode == READ_TO_BLOCK)
+        {
+            // Discard message terminator following the block and stop reading
+            // at the end of the terminator (LF or EOI)
+            if (blockState == BLOCK_END)
+            {
+                if (eoiStatus == 1 || c == LF)
+                    break;
+                
+                continue;
+            }
+            
+            switch (blockState)
+            {
+                case BLOCK_PREFIX:
+                    if (c == '#')
+                        blockState = BLOCK_DIGITS;
+                    break;
+                    
+                case BLOCK_DIGITS:
+                    blockDigits = c - '0';
+                    
+                    // Read until EOI if not a definite length block
+                    // Note: #0 (indefinite length block) is valid.
+                    if (blockDigits > 9)
+                        ack_status(ACK_ERROR);
+                    
+                    if (blockDigits < 1 || blockDigits > 9)
+                        readMode = READ_TO_EOI;
+                    else
+                        blockState = BLOCK_LENGTH;
+                    break;
+                    
+                case BLOCK_LENGTH:
+                    // Read until EOI if the block length is not a number
+                    if (c < '0' || c > '9')
+                    {
+                        ack_status(ACK_ERROR);
+                        readMode = READ_TO_EOI;
+                        break;
+                    }
+                    
+                    blockLength = (blockLength * 10) + (c - '0');
+                    blockDigits--;
+                    
+                    if (blockDigits == 0)
+                        blockState = (blockLength > 0) ? BLOCK_DATA : BLOCK_END;
+                    break;
+                    
+                case BLOCK_DATA:
+                    blockLength--;
+                    
+                    if (blockLength == 0)
+                        blockState = BLOCK_END;
+                    break;
+            }
+            
+            // Output last byte of the block and stop reading at EOI
+            if (blockState == BLOCK_END)
+            {
+                tx_putc(c);
+                _ackCount++;
+                
+                if (eoiStatus == 1)
+                    break;
+                
+                continue;
+            }
+        }
             
-        // Output character that was read    
-        putc(c);
+        // Output character that was read
+        // Note: Characters are queued in the UART transmit buffer, so the
+        //       handshake for the next byte overlaps the UART output.
+        tx_putc(c);
+        _ackCount++;
         
         // Output end-of-transmission (EOT) character if enabled and EOI detected
-        if (_eotEnable && eoiStatus == 1)
-            putc(_eotChar);
+        // Note: No EOT character is output in read to block mode.
+        if (_eotEnable && eoiStatus == 1 && !blockMode)
+            tx_putc(_eotChar);
+            
+        // Stop reading at EOI in read to EOI mode (or read to block mode before the block is complete)
+        if ((readMode == READ_TO_EOI || readMode == READ_TO_BLOCK) && eoiStatus == 1)
+        {
+            // The block ended before all <Length> data bytes were received
+            if (readMode == READ_TO_BLOCK && blockState != BLOCK_PREFIX)
+                ack_status(ACK_ERROR);
             
-        // Stop reading at EOI in read to EOI mode
-        if (readMode == READ_TO_EOI && eoiStatus == 1)
             break;
+        }
         
         // Stop reading at specified character in read to character mode
         if (readMode == READ_TO_CHAR && c == readToChar)
             break;
     }
 
+    // A read to timeout normally ends with a timeout once data was received
+    if (recvTimeout && readMode == READ_TO_TIMEOUT && _ackCount != ackCount && _ackStatus == ACK_TIMEOUT_DAV)
+        _ackStatus = ackStatus;
+
 #ifdef VERBOSE_DEBUG
     eot_printf("GPIB Read End...");
 #endif
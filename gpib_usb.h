@@ -48,3 +48,25 @@ A pre-compiled hex file is included at
 
 #define LED_ERROR PIN_C5  // LED Indicator
 
+// Optional USB UART hardware flow control (See ++flow command)
+// Note: Only define this pin if it is wired to the CTS# input of the USB UART.
+//#define HOST_CTS PIN_C0  // Clear To Send output to host (Low = host may send)
+
+#bit TRMT = getenv("BIT:TRMT")  // UART Transmit Shift Register Empty
+
+// Direct port access for the acceptor handshake (See gpib_receive_handshake())
+// Note: These bypass standard_io, so they do not set the pin directions.
+//       The directions are set once per message by gpib_receive_start().
+#byte PORTA = getenv("SFR:PORTA")
+#byte LATA = getenv("SFR:LATA")
+#byte PORTB = getenv("SFR:PORTB")
+#bit EOI_IN = PORTA.2    // EOI input (PIN_A2)
+#bit DAV_IN = PORTA.3    // DAV input (PIN_A3)
+#bit NRFD_OUT = LATA.4   // NRFD output latch (PIN_A4)
+#bit NDAC_OUT = LATA.5   // NDAC output latch (PIN_A5)
+
+#bit BRGH = getenv("BIT:BRGH")       // UART High Baud Rate Select
+#bit BRG16 = getenv("BIT:BRG16")     // UART 16-bit Baud Rate Generator
+#byte SPBRG = getenv("SFR:SPBRG")    // UART Baud Rate Generator (Low Byte)
+#byte SPBRGH = getenv("SFR:SPBRGH")  // UART Baud Rate Generator (High Byte)
+
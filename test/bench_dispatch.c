@@ -0,0 +1,135 @@
+/*****************************************************************************
+Host microbenchmark for the controller command lookup (See gpib_cmd.c)
+
+Every command name in the table is looked up repeatedly and the average time
+and number of table entries compared per lookup are reported. A linear scan
+of the table (one string compare per entry, like the former strncmp chain)
+is measured for comparison. Host times are only relative; the number of
+entries compared is what determines the dispatch cost on the PIC.
+
+Build and run: make -C test bench
+*****************************************************************************/
+
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "../gpib_cmd.h"
+
+void command_table_init();
+uint8_t command_lookup(char *name);
+
+#include "../gpib_cmd.c"
+
+
+#define LOOKUP_COUNT 1000000
+
+volatile uint8_t _sink;
+
+
+static uint8_t command_lookup_linear(char *name, uint8_t *compares)
+{
+    // Finds a command by comparing the name with every table entry in order
+
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++)
+    {
+        (*compares)++;
+
+        if (strcmp(_commandTable[i].name, name) == 0)
+            return i;
+    }
+
+    return CMD_NONE;
+}
+
+
+static double elapsed_ns(struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+
+int main()
+{
+    int failures = 0;
+    double tableMax = 0, tableMin = 1e9, linearMax = 0, linearMin = 1e9;
+    uint8_t groupMax = 0;
+
+    command_table_init();
+
+    printf("%-12s %10s %8s %10s %8s\n", "Command", "Table ns", "Entries", "Linear ns", "Entries");
+
+    for (uint8_t i = 0; i < COMMAND_COUNT; i++)
+    {
+        char name[COMMAND_NAME_LEN];
+        strcpy(name, _commandTable[i].name);
+
+        // Each name must resolve to its own entry
+        if (command_lookup(name) != i)
+        {
+            printf("%s: lookup failed\n", name);
+            failures++;
+        }
+
+        // Entries compared by command_lookup() (up to the matching entry)
+        uint8_t c = name[0] - 'a';
+        uint8_t tableCompares = i - _commandIndex[c] + 1;
+        uint8_t group = _commandIndex[c + 1] - _commandIndex[c];
+
+        if (group > groupMax)
+            groupMax = group;
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (uint32_t n = 0; n < LOOKUP_COUNT; n++)
+            _sink = command_lookup(name);
+
+        double tableNs = elapsed_ns(&start) / LOOKUP_COUNT;
+
+        uint8_t linearCompares = 0;
+        command_lookup_linear(name, &linearCompares);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (uint32_t n = 0; n < LOOKUP_COUNT; n++)
+        {
+            uint8_t compares = 0;
+            _sink = command_lookup_linear(name, &compares);
+        }
+
+        double linearNs = elapsed_ns(&start) / LOOKUP_COUNT;
+
+        if (tableNs > tableMax) tableMax = tableNs;
+        if (tableNs < tableMin) tableMin = tableNs;
+        if (linearNs > linearMax) linearMax = linearNs;
+        if (linearNs < linearMin) linearMin = linearNs;
+
+        printf("%-12s %10.1f %8u %10.1f %8u\n", name, tableNs, tableCompares, linearNs, linearCompares);
+    }
+
+    // Unknown names must not be found
+    char unknown[][COMMAND_NAME_LEN] = { "verx", "re", "Addr", "zzz", "" };
+
+    for (uint8_t i = 0; i < sizeof(unknown) / sizeof(unknown[0]); i++)
+    {
+        if (command_lookup(unknown[i]) != CMD_NONE)
+        {
+            printf("'%s': unexpected match\n", unknown[i]);
+            failures++;
+        }
+    }
+
+    printf("\nTable lookup:  %.1f - %.1f ns, at most %u entries compared\n", tableMin, tableMax, groupMax);
+    printf("Linear scan:   %.1f - %.1f ns, up to %u entries compared\n", linearMin, linearMax, (unsigned)COMMAND_COUNT);
+
+    return (failures > 0) ? 1 : 0;
+}
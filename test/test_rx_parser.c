@@ -0,0 +1,464 @@
+/*****************************************************************************
+Host test for the UART receive line parser (See gpib_rx.c)
+
+The parser is compiled with the host C compiler and fed character sequences
+as RDA_isr() would. The ring buffer entries it produces are then checked.
+
+Build and run: make -C test
+*****************************************************************************/
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Definitions normally provided by gpib_usb.c
+#define CR  0x0d  // Carriage Return
+#define LF  0x0a  // Line Feed
+#define ESC 0x1b  // Escape
+#define CAN 0x18  // Cancel (Abort)
+#define SP  0x20  // Space
+
+typedef struct
+{
+    uint32_t linesReceived;
+} Statistics;
+
+Statistics _stats;
+volatile bool _abortRequest = false;
+uint8_t _abortFlushIndex = 0;
+
+#include "../gpib_rx.h"
+
+void rx_parse_char(char c);
+bool rx_entry_add(bool isCommand);
+
+#include "../gpib_rx.c"
+
+
+static int _failures = 0;
+
+#define check(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        _failures++; \
+    } \
+} while (0)
+
+
+static void reset()
+{
+    // Returns the ring buffer and line state to power-up values
+
+    memset(_ringBuffer, 0, sizeof(_ringBuffer));
+    _ringBufferRead = 0;
+    _ringBufferWrite = 0;
+    _ringBufferNext = 0;
+
+    _rxWriteIndex = 0;
+    _rxByteLen = 0;
+    _rxCharCount = 0;
+    _rxChar1 = '\0';
+    _rxChar2 = '\0';
+    _rxEscapeNext = false;
+    _rxDiscard = false;
+    _rxBatch = false;
+    _rxSplitCount = 0;
+    _rxOverflowCount = 0;
+
+    _rxRawMatch = 0;
+    _rxRawLength = 0;
+    _rxRawCount = 0;
+    _rxRawMode = false;
+    _rxRawSkipLf = false;
+
+    _stats.linesReceived = 0;
+    _abortRequest = false;
+    _abortFlushIndex = 0;
+}
+
+
+static void feed(const char *data, size_t length)
+{
+    // Passes characters to the parser one at a time (as RDA_isr() does)
+
+    for (size_t i = 0; i < length; i++)
+        rx_parse_char(data[i]);
+}
+
+
+#define feed_str(str) feed((str), sizeof(str) - 1)
+
+
+static bool entry_pop(uint8_t ccf, const char *data, uint8_t length)
+{
+    // Checks the next ring buffer entry and releases it.
+    // The data is compared in place, so entries wrapping around the end of
+    // the ring buffer also check the mirror.
+
+    if (_ringBufferRead == _ringBufferWrite)
+    {
+        printf("  expected entry, ring buffer is empty\n");
+        return false;
+    }
+
+    uint8_t index = _ringBufferRead;
+    uint8_t entryCcf = _ringBuffer[index];
+    uint8_t entryLength = _ringBuffer[(uint8_t)(index + 1)];
+    uint8_t dataIndex = index + 2;
+
+    _ringBufferRead = index + 2 + entryLength;
+
+    if (entryCcf != ccf || entryLength != length
+        || memcmp(&_ringBuffer[dataIndex], data, length) != 0)
+    {
+        printf("  entry mismatch: ccf %u/%u, length %u/%u\n",
+            entryCcf, ccf, entryLength, length);
+        return false;
+    }
+
+    return true;
+}
+
+
+#define command_pop(str) entry_pop(CCF_COMMAND, (str), sizeof(str))
+#define data_pop(str)    entry_pop(CCF_DATA, (str), sizeof(str) - 1)
+#define binary_pop(str)  entry_pop(CCF_BINARY, (str), sizeof(str) - 1)
+#define buffer_empty()   (_ringBufferRead == _ringBufferWrite)
+
+
+static void test_back_to_back_lines()
+{
+    reset();
+    feed_str("++addr 5\r\n*IDN?\n++read eoi\r");
+
+    check(command_pop("addr 5"));
+    check(data_pop("*IDN?"));
+    check(command_pop("read eoi"));
+    check(buffer_empty());
+    check(_stats.linesReceived == 3);
+}
+
+
+static void test_partial_line_not_visible()
+{
+    reset();
+    feed_str("*IDN");
+
+    check(buffer_empty());
+
+    feed_str("?\n");
+
+    check(data_pop("*IDN?"));
+    check(buffer_empty());
+}
+
+
+static void test_escapes()
+{
+    reset();
+    feed_str("A\x1b+\x1b\r\x1b\n\x1b\x1b\x1b\x18;B\n");
+
+    check(data_pop("A+\r\n\x1b\x18;B"));
+    check(buffer_empty());
+    check(!_abortRequest);
+
+    // Un-escaped '+' characters in device data are discarded
+    reset();
+    feed_str("1+2\n");
+
+    check(data_pop("12"));
+}
+
+
+static void test_batch_line()
+{
+    reset();
+    feed_str("++addr 7;MEAS:VOLT?;++read eoi;++addr 9;*TRG\n");
+
+    check(command_pop("addr 7"));
+    check(data_pop("MEAS:VOLT?"));
+    check(command_pop("read eoi"));
+    check(command_pop("addr 9"));
+    check(data_pop("*TRG"));
+    check(buffer_empty());
+
+    // Device data keeps ';' unless followed by '++', spaces after ';' are skipped
+    reset();
+    feed_str("++addr 7; *RST;*CLS;++read eoi\n");
+
+    check(command_pop("addr 7"));
+    check(data_pop("*RST;*CLS"));
+    check(command_pop("read eoi"));
+    check(buffer_empty());
+
+    // Escaped ';' does not end a command
+    reset();
+    feed_str("++macro\x1b;x\n");
+
+    check(command_pop("macro;x"));
+    check(buffer_empty());
+
+    // Lines not starting with '++' are not split
+    reset();
+    feed_str("A;++B\n");
+
+    check(data_pop("A;B"));
+    check(buffer_empty());
+}
+
+
+static void test_binary_write()
+{
+    // CR terminated command line: following LF belongs to the termination
+    reset();
+    feed_str("++bwrite 5\r\nab\r\nc++ver\n");
+
+    check(command_pop("bwrite 5"));
+    check(binary_pop("ab\r\nc"));
+    check(command_pop("ver"));
+    check(buffer_empty());
+
+    // LF terminated command line: a following LF is binary data
+    reset();
+    feed_str("++bwrite 3\n\n\x18+\n");
+
+    check(command_pop("bwrite 3"));
+    check(binary_pop("\n\x18+"));
+    check(buffer_empty());
+    check(!_abortRequest);
+
+    // Binary data is split into RAW_CHUNK_LEN byte entries
+    reset();
+    feed_str("++bwrite 70\n");
+
+    char data[70];
+    for (int i = 0; i < 70; i++)
+        data[i] = (char)i;
+
+    feed(data, sizeof(data));
+
+    check(command_pop("bwrite 70"));
+    check(entry_pop(CCF_BINARY, data, RAW_CHUNK_LEN));
+    check(entry_pop(CCF_BINARY, data + RAW_CHUNK_LEN, 70 - RAW_CHUNK_LEN));
+    check(buffer_empty());
+    check(!_rxRawMode);
+
+    // Binary write must be the last command of a batch line
+    reset();
+    feed_str("++addr 5;++bwrite 2\nxy");
+
+    check(command_pop("addr 5"));
+    check(command_pop("bwrite 2"));
+    check(binary_pop("xy"));
+    check(buffer_empty());
+
+    // Other commands starting with "bwrite" do not enter binary mode
+    reset();
+    feed_str("++bwrite\nxy\n");
+
+    check(command_pop("bwrite"));
+    check(data_pop("xy"));
+    check(buffer_empty());
+}
+
+
+static void test_abort()
+{
+    reset();
+    feed_str("++addr 5\n*ID");
+
+    uint8_t flushIndex = _ringBufferWrite;
+
+    feed_str("\x18x\n");
+
+    check(_abortRequest);
+    check(_abortFlushIndex == flushIndex);
+    check(command_pop("addr 5"));
+    check(data_pop("x"));
+    check(buffer_empty());
+
+    // CAN discards a partially received batch line
+    reset();
+    feed_str("++addr 5;++read\x18");
+
+    check(_abortRequest);
+    check(command_pop("addr 5"));
+    check(buffer_empty());
+
+    feed_str("++ver\n");
+
+    check(command_pop("ver"));
+    check(buffer_empty());
+}
+
+
+static void test_overflow()
+{
+    // Fill the ring buffer with lines that are not released
+    reset();
+
+    char line[41];
+    memset(line, 'A', sizeof(line) - 1);
+    line[sizeof(line) - 1] = LF;
+
+    for (int i = 0; i < 6; i++)
+        feed(line, sizeof(line));
+
+    check(_stats.linesReceived == 6);
+    check(_rxOverflowCount == 0);
+
+    // The next line does not fit and is discarded
+    feed(line, sizeof(line));
+
+    check(_stats.linesReceived == 6);
+    check(_rxOverflowCount == 1);
+
+    // Lines fit again once entries are released
+    for (int i = 0; i < 6; i++)
+        check(entry_pop(CCF_DATA, line, sizeof(line) - 1));
+
+    feed_str("*IDN?\n");
+
+    check(data_pop("*IDN?"));
+    check(buffer_empty());
+    check(_rxOverflowCount == 1);
+}
+
+
+static void test_command_too_long()
+{
+    reset();
+
+    char line[2 + COMMAND_MAX_LEN + 2];
+    line[0] = '+';
+    line[1] = '+';
+    memset(&line[2], 'a', COMMAND_MAX_LEN + 1);
+    line[sizeof(line) - 1] = LF;
+
+    feed(line, sizeof(line));
+
+    check(buffer_empty());
+    check(_rxOverflowCount == 1);
+
+    // A command of the maximum length is accepted
+    reset();
+    feed(line, 2 + COMMAND_MAX_LEN);
+    feed_str("\n");
+
+    check(!buffer_empty());
+    check(_ringBuffer[1] == COMMAND_MAX_LEN + 1);
+    check(_rxOverflowCount == 0);
+}
+
+
+static void test_wrap_around()
+{
+    // Commands wrapping around the end of the ring buffer are read in place
+    // from the mirror
+    reset();
+
+    for (int i = 0; i < 100; i++)
+    {
+        feed_str("++read_tmo_ms 500\n");
+        check(command_pop("read_tmo_ms 500"));
+
+        feed_str("SOME:DEVICE:DATA 1,2,3\n");
+        check(data_pop("SOME:DEVICE:DATA 1,2,3"));
+    }
+
+    check(buffer_empty());
+    check(_rxOverflowCount == 0);
+}
+
+#define PIPELINE_LINES 5000  // Lines sent by test_pipelined_lines()
+#define PIPELINE_DEPTH 4     // Lines kept queued by test_pipelined_lines()
+
+
+static void test_pipelined_lines()
+{
+    // Thousands of mixed command and data lines are sent back to back while
+    // several lines stay queued, as when the main loop falls behind the host
+
+    struct
+    {
+        uint8_t ccf;
+        char data[48];
+        uint8_t length;
+    } expected[PIPELINE_DEPTH + 1];
+
+    uint8_t head = 0;
+    uint8_t queued = 0;
+    bool inOrder = true;
+
+    reset();
+
+    for (int i = 0; i < PIPELINE_LINES; i++)
+    {
+        char line[56];
+        uint8_t slot = (head + queued) % (PIPELINE_DEPTH + 1);
+        bool isCommand = (i % 3 != 1);
+
+        // Build a line of varying length (Commands are stored with a null terminator)
+        int length = snprintf(expected[slot].data, sizeof(expected[slot].data),
+            isCommand ? "read_tmo_ms %d" : "MEAS:VOLT? %d;", i);
+        memset(&expected[slot].data[length], 'a' + (i % 26), i % 23);
+        length += i % 23;
+        expected[slot].data[length] = '\0';
+
+        expected[slot].ccf = isCommand ? CCF_COMMAND : CCF_DATA;
+        expected[slot].length = isCommand ? length + 1 : length;
+        queued++;
+
+        int lineLength = snprintf(line, sizeof(line), "%s%s%s",
+            isCommand ? "++" : "", expected[slot].data, (i % 2) ? "\r\n" : "\n");
+        feed(line, lineLength);
+
+        // Release the oldest line once the queue is full
+        if (queued > PIPELINE_DEPTH)
+        {
+            inOrder = inOrder && entry_pop(expected[head].ccf, expected[head].data, expected[head].length);
+            head = (head + 1) % (PIPELINE_DEPTH + 1);
+            queued--;
+        }
+    }
+
+    // Release the remaining lines
+    while (queued > 0)
+    {
+        inOrder = inOrder && entry_pop(expected[head].ccf, expected[head].data, expected[head].length);
+        head = (head + 1) % (PIPELINE_DEPTH + 1);
+        queued--;
+    }
+
+    check(inOrder);
+    check(buffer_empty());
+    check(_stats.linesReceived == PIPELINE_LINES);
+    check(_rxOverflowCount == 0);
+}
+
+
+
+int main()
+{
+    test_back_to_back_lines();
+    test_partial_line_not_visible();
+    test_escapes();
+    test_batch_line();
+    test_binary_write();
+    test_abort();
+    test_overflow();
+    test_command_too_long();
+    test_wrap_around();
+    test_pipelined_lines();
+
+    if (_failures > 0)
+    {
+        printf("%d check(s) failed\n", _failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}